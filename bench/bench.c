@@ -0,0 +1,170 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "../lenv.h"
+#include "../lval.h"
+#include "../lgc.h"
+#include "../builtin.h"
+
+/* Benchmark driver.
+ *
+ * Each workload file is loaded once, then '(bench 0)' is timed over a
+ * number of runs after a few warmup runs. A file may set 'bench-runs'
+ * to change the number of runs, unless --runs is given. The 'read' workload times the reader
+ * over generated source instead. Each workload runs in its own process
+ * so its peak RSS is its own, and prints one line of JSON. */
+
+#define BENCH_RUNS 30
+#define BENCH_WARMUP 3
+
+static long bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int bench_cmp(const void* x, const void* y) {
+  long a = *(long*)x;
+  long b = *(long*)y;
+  return (a > b) - (a < b);
+}
+
+static void bench_report(char* name, long* ns, int runs, long allocs) {
+  qsort(ns, runs, sizeof(long), bench_cmp);
+  int p99 = (runs * 99 + 99) / 100 - 1;
+
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+
+  printf("{\"name\": \"%s\", \"runs\": %i, \"median_ns\": %li, "
+    "\"p99_ns\": %li, \"min_ns\": %li, \"allocs_per_run\": %li, "
+    "\"peak_rss_kb\": %li}\n",
+    name, runs, ns[runs / 2], ns[p99], ns[0], allocs / runs, ru.ru_maxrss);
+}
+
+/* Source with one definition per line, nesting lists and vectors */
+static char* bench_source(int lines, long* n) {
+  char* s = malloc((long)lines * 96);
+  long len = 0;
+  for (int i = 0; i < lines; i++) {
+    len += sprintf(s + len,
+      "(def {x%i} (+ %i (* 2 3) {a b {c d}} \"text\\n\" [1 2 3])) ; %i\n",
+      i, i, i);
+  }
+  *n = len;
+  return s;
+}
+
+static int bench_read(int runs) {
+  long n;
+  char* s = bench_source(20000, &n);
+  long* ns = malloc(sizeof(long) * runs);
+  long allocs = 0;
+
+  for (int i = -BENCH_WARMUP; i < runs; i++) {
+    long a = lgc_cur->allocated;
+    long t = bench_now();
+    lval* v = lval_sexpr();
+    lval_read_expr(v, s, 0, n, '\0');
+    if (i >= 0) { ns[i] = bench_now() - t; allocs += lgc_cur->allocated - a; }
+    lval_del(v);
+  }
+
+  bench_report("read", ns, runs, allocs);
+  free(ns);
+  free(s);
+  return 0;
+}
+
+/* Run 'runs' times, or as many as the file sets if 'runs' is zero */
+static int bench_file(char* path, int runs) {
+  lenv* e = lenv_new();
+  lenv_add_builtins(e);
+
+  lval* x = builtin_load(e, lval_add(lval_sexpr(), lval_str(path)));
+  if (lval_type(x) == LVAL_ERR) {
+    fprintf(stderr, "%s: ", path);
+    lval_println(x);
+    return 1;
+  }
+  lval_del(x);
+
+  if (!runs) {
+    lval* k = lval_sym("bench-runs");
+    x = lenv_get(e, k);
+    runs = lval_type(x) == LVAL_NUM && lval_as_num(x) > 0
+      ? lval_as_num(x) : BENCH_RUNS;
+    lval_del(x);
+    lval_del(k);
+  }
+
+  /* Name the workload after its file */
+  char* name = strrchr(path, '/');
+  name = name ? name + 1 : path;
+  char* dot = strrchr(name, '.');
+  if (dot) { *dot = '\0'; }
+
+  long* ns = malloc(sizeof(long) * runs);
+  long allocs = 0;
+  for (int i = -BENCH_WARMUP; i < runs; i++) {
+    lval* expr = lval_sexpr();
+    lval_add(expr, lval_sym("bench"));
+    lval_add(expr, lval_num(0));
+
+    long a = lgc_cur->allocated;
+    long t = bench_now();
+    x = lval_eval(e, expr);
+    if (i >= 0) { ns[i] = bench_now() - t; allocs += lgc_cur->allocated - a; }
+
+    if (lval_type(x) == LVAL_ERR) {
+      fprintf(stderr, "%s: ", path);
+      lval_println(x);
+      return 1;
+    }
+    lval_del(x);
+  }
+
+  bench_report(name, ns, runs, allocs);
+  free(ns);
+  lenv_del(e);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  /* Zero lets each file choose */
+  int runs = 0;
+  int first = 1;
+  if (argc > 2 && strcmp(argv[1], "--runs") == 0) {
+    runs = atoi(argv[2]);
+    first = 3;
+    if (runs < 1) { first = argc; }
+  }
+  if (first == argc) {
+    fprintf(stderr, "usage: bench [--runs n] read|file.lspy...\n");
+    return 1;
+  }
+
+  int status = 0;
+  for (int i = first; i < argc; i++) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      return strcmp(argv[i], "read") == 0
+        ? bench_read(runs ? runs : BENCH_RUNS) : bench_file(argv[i], runs);
+    }
+    int st;
+    if (pid < 0 || waitpid(pid, &st, 0) < 0
+      || !WIFEXITED(st) || WEXITSTATUS(st) != 0) {
+      fprintf(stderr, "bench: %s failed\n", argv[i]);
+      status = 1;
+    }
+  }
+  return status;
+}
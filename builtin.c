@@ -1,23 +1,43 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "lenv.h"
 #include "lval.h"
+#include "lsym.h"
+#include "lnum.h"
+#include "lmemo.h"
+#include "lmap.h"
+#include "lstr.h"
+#include "lprof.h"
+#include "lstats.h"
+#include "lpar.h"
+#include "limg.h"
+#include "builtin.h"
 
 lval* builtin_head(lenv* e, lval* a) {
   LASSERT(a, a->count == 1,
     "Function 'head' passed too many arguments. "
     "Got %i, Expected %i.",
     a->count, 1);
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
+  LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR,
     "Function 'head' passed incorrect type for argument 0. "
     "Got %s, Expected %s.",
-    ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+    ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
   LASSERT(a, a->cell[0]->count != 0,
     "Function 'head' passed {}!");
 
-  lval* v = lval_take(a, 0);
-  while (v->count > 1) { lval_del(lval_pop(v, 1)); }
+  lval* v = lval_slice(a->cell[0], 0, 1);
+  lval_del(a);
   return v;
 }
 
@@ -26,15 +46,15 @@ lval* builtin_tail(lenv* e, lval* a) {
     "Function 'tail' passed too many arguments. "
     "Got %i, Expected %i.",
     a->count, 1);
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
+  LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR,
     "Function 'tail' passed incorrect type for argument 0. "
     "Got %s, Expected %s.",
-    ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+    ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
   LASSERT(a, a->cell[0]->count != 0,
     "Function 'tail' passed {}!");
 
-  lval* v = lval_take(a, 0);
-  lval_del(lval_pop(v, 0));
+  lval* v = lval_slice(a->cell[0], 1, a->cell[0]->count);
+  lval_del(a);
   return v;
 }
 
@@ -43,28 +63,35 @@ lval* builtin_list(lenv* e, lval* a) {
   return a;
 }
 
-lval* builtin_eval(lenv* e, lval* a) {
+/* Check the arguments of 'eval' and return the expression it evaluates */
+lval* builtin_eval_expr(lval* a) {
   LASSERT(a, a->count == 1,
     "Function 'eval' passed too many arguments. "
     "Got %i, Expected %i.",
     a->count, 1);
-  LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
+  LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR,
     "Function 'eval' passed incorrect type for argument 0. "
     "Got %s, Expected %s.",
-    ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+    ltype_name(lval_type(a->cell[0])), ltype_name(LVAL_QEXPR));
 
-  lval* x = lval_take(a, 0);
+  lval* x = lval_own(lval_take(a, 0));
   x->type = LVAL_SEXPR;
+  return x;
+}
+
+lval* builtin_eval(lenv* e, lval* a) {
+  lval* x = builtin_eval_expr(a);
+  if (lval_type(x) == LVAL_ERR) { return x; }
   return lval_eval(e, x);
 }
 
 lval* builtin_join(lenv* e, lval* a) {
 
   for (int i = 0; i < a->count; i++) {
-    LASSERT(a, a->cell[i]->type == LVAL_QEXPR,
+    LASSERT(a, lval_type(a->cell[i]) == LVAL_QEXPR,
       "Function 'join' passed incorrect type for argument %d. "
       "Got %s, Expected %s.",
-      i, ltype_name(a->cell[i]->type), ltype_name(LVAL_QEXPR));
+      i, ltype_name(lval_type(a->cell[i])), ltype_name(LVAL_QEXPR));
   }
 
   lval* x = lval_pop(a, 0);
@@ -77,15 +104,904 @@ lval* builtin_join(lenv* e, lval* a) {
   return x;
 }
 
+/* Value of a list item as the library's 'fst' gives it, which
+ * evaluates the item */
+static lval* builtin_item(lenv* e, lval* x) {
+  return lval_eval(e, lval_copy(x));
+}
+
+/* Apply f to one or two arguments */
+static lval* builtin_call(lenv* e, lval* f, lval* x, lval* y) {
+  lval* a = lval_reserve(lval_sexpr(), 2);
+  lval_add(a, x);
+  if (y) { lval_add(a, y); }
+  return lval_call(e, lval_copy(f), a);
+}
+
+/* Apply builtin f through a lambda with the formals of the library
+ * definition it replaced, so that fewer arguments than those give a
+ * partial application as they did with the library */
+static lval* builtin_partial(lenv* e, lval* a, lbuiltin f, char* formals) {
+  lval* fs = lval_qexpr();
+  lval_read_expr(fs, formals, 0, strlen(formals), '\0');
+
+  lval* body = lval_add(lval_qexpr(), lval_fun(f));
+  for (int i = 0; i < fs->count; i++) {
+    lval_add(body, lval_copy(fs->cell[i]));
+  }
+  body = lval_resolve(fs, body);
+  return lval_call(e, lval_lambda(fs, body), a);
+}
+
+lval* builtin_len(lenv* e, lval* a) {
+  if (a->count < 1) { return builtin_partial(e, a, builtin_len, "l"); }
+  LASSERT_NUM("len", a, 1);
+  LASSERT_TYPE("len", a, 0, LVAL_QEXPR);
+
+  lval* x = lval_num(a->cell[0]->count);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_nth(lenv* e, lval* a) {
+  if (a->count < 2) { return builtin_partial(e, a, builtin_nth, "n l"); }
+  LASSERT_NUM("nth", a, 2);
+  LASSERT_TYPE("nth", a, 0, LVAL_NUM);
+  LASSERT_TYPE("nth", a, 1, LVAL_QEXPR);
+
+  long n = lval_as_num(a->cell[0]);
+  lval* l = a->cell[1];
+  LASSERT(a, n >= 0 && n < l->count,
+    "Function 'nth' passed index %li out of range. "
+    "List has length %i.", n, l->count);
+
+  lval* x = builtin_item(e, l->cell[n]);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_take(lenv* e, lval* a) {
+  if (a->count < 2) { return builtin_partial(e, a, builtin_take, "n l"); }
+  LASSERT_NUM("take", a, 2);
+  LASSERT_TYPE("take", a, 0, LVAL_NUM);
+  LASSERT_TYPE("take", a, 1, LVAL_QEXPR);
+
+  long n = lval_as_num(a->cell[0]);
+  lval* l = a->cell[1];
+  LASSERT(a, n >= 0 && n <= l->count,
+    "Function 'take' passed count %li out of range. "
+    "List has length %i.", n, l->count);
+
+  lval* x = lval_slice(l, 0, n);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_drop(lenv* e, lval* a) {
+  if (a->count < 2) { return builtin_partial(e, a, builtin_drop, "n l"); }
+  LASSERT_NUM("drop", a, 2);
+  LASSERT_TYPE("drop", a, 0, LVAL_NUM);
+  LASSERT_TYPE("drop", a, 1, LVAL_QEXPR);
+
+  long n = lval_as_num(a->cell[0]);
+  lval* l = a->cell[1];
+  LASSERT(a, n >= 0 && n <= l->count,
+    "Function 'drop' passed count %li out of range. "
+    "List has length %i.", n, l->count);
+
+  /* Dropping nothing gives the list itself */
+  if (n == 0) { return lval_take(a, 1); }
+
+  lval* x = lval_slice(l, n, l->count);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_elem(lenv* e, lval* a) {
+  if (a->count < 2) { return builtin_partial(e, a, builtin_elem, "x l"); }
+  LASSERT_NUM("elem", a, 2);
+  LASSERT_TYPE("elem", a, 1, LVAL_QEXPR);
+
+  lval* l = a->cell[1];
+  for (int i = 0; i < l->count; i++) {
+    lval* y = builtin_item(e, l->cell[i]);
+    if (lval_type(y) == LVAL_ERR) { lval_del(a); return y; }
+    int found = lval_eq(a->cell[0], y);
+    lval_del(y);
+    if (found) { lval_del(a); return lval_num(1); }
+  }
+
+  lval_del(a);
+  return lval_num(0);
+}
+
+lval* builtin_map(lenv* e, lval* a) {
+  if (a->count < 2) { return builtin_partial(e, a, builtin_map, "f l"); }
+  LASSERT_NUM("map", a, 2);
+  LASSERT_TYPE("map", a, 0, LVAL_FUN);
+  LASSERT_TYPE("map", a, 1, LVAL_QEXPR);
+
+  lval* f = a->cell[0];
+  lval* l = a->cell[1];
+  lval* x = lval_reserve(lval_qexpr(), l->count);
+
+  for (int i = 0; i < l->count; i++) {
+    lval* y = builtin_item(e, l->cell[i]);
+    if (lval_type(y) != LVAL_ERR) { y = builtin_call(e, f, y, NULL); }
+    if (lval_type(y) == LVAL_ERR) { lval_del(x); lval_del(a); return y; }
+    x->cell[x->count++] = y;
+  }
+
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_filter(lenv* e, lval* a) {
+  if (a->count < 2) { return builtin_partial(e, a, builtin_filter, "f l"); }
+  LASSERT_NUM("filter", a, 2);
+  LASSERT_TYPE("filter", a, 0, LVAL_FUN);
+  LASSERT_TYPE("filter", a, 1, LVAL_QEXPR);
+
+  lval* f = a->cell[0];
+  lval* l = a->cell[1];
+  lval* x = lval_qexpr();
+
+  for (int i = 0; i < l->count; i++) {
+    lval* y = builtin_item(e, l->cell[i]);
+    if (lval_type(y) != LVAL_ERR) { y = builtin_call(e, f, y, NULL); }
+    if (lval_type(y) == LVAL_ERR) { lval_del(x); lval_del(a); return y; }
+
+    /* Condition is tested as 'if' would */
+    if (lval_type(y) != LVAL_NUM) {
+      lval* err = lval_err("Function 'filter' passed function returning %s, "
+        "Expected %s.", ltype_name(lval_type(y)), ltype_name(LVAL_NUM));
+      lval_del(y); lval_del(x); lval_del(a);
+      return err;
+    }
+
+    /* The item is kept as written, not as evaluated */
+    if (lval_as_num(y)) { lval_add(x, lval_copy(l->cell[i])); }
+  }
+
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_foldl(lenv* e, lval* a) {
+  if (a->count < 3) { return builtin_partial(e, a, builtin_foldl, "f z l"); }
+  LASSERT_NUM("foldl", a, 3);
+  LASSERT_TYPE("foldl", a, 0, LVAL_FUN);
+  LASSERT_TYPE("foldl", a, 2, LVAL_QEXPR);
+
+  lval* f = a->cell[0];
+  lval* l = a->cell[2];
+
+  /* Folding numbers with '+' or '*' is a sum or product. The kernels
+   * reduce out of order, so on overflow the fold is made in order below,
+   * which only fails if a partial result in that order overflows. */
+  if ((f->builtin == builtin_add || f->builtin == builtin_mul)
+    && lval_type(a->cell[1]) == LVAL_NUM) {
+    int add = f->builtin == builtin_add;
+    long x;
+    int status = add ? lnum_sum(l->cell, l->count, &x)
+      : lnum_product(l->cell, l->count, &x);
+    if (status == LNUM_OK) {
+      long z = lval_as_num(a->cell[1]);
+      if (add ? lnum_add(z, x, &x) : lnum_mul(z, x, &x)) {
+        status = LNUM_OVERFLOW;
+      }
+    }
+    if (status == LNUM_OK) {
+      lval_del(a);
+      return lval_num(x);
+    }
+  }
+
+  lval* z = lval_copy(a->cell[1]);
+
+  for (int i = 0; i < l->count; i++) {
+    lval* y = builtin_item(e, l->cell[i]);
+    if (lval_type(y) == LVAL_ERR) { lval_del(z); z = y; break; }
+    z = builtin_call(e, f, z, y);
+    if (lval_type(z) == LVAL_ERR) { break; }
+  }
+
+  lval_del(a);
+  return z;
+}
+
+/* Cells of a list or vector */
+static lval** builtin_cells(lval* l, int* n) {
+  if (lval_type(l) == LVAL_VEC) {
+    *n = l->len;
+    return lval_vec_cells(l);
+  }
+  *n = l->count;
+  return l->cell;
+}
+
+/* Function and list or vector of a parallel builtin, and the result for
+ * each item. A reduction keeps the result of each chunk at its start. */
+typedef struct {
+  lval* f;
+  lval* l;
+  lval** xs;
+  lval** ys;
+} builtin_par;
+
+static lval* builtin_par_item(lenv* e, builtin_par* p, int i) {
+  return lval_type(p->l) == LVAL_VEC
+    ? lval_copy(p->xs[i]) : builtin_item(e, p->xs[i]);
+}
+
+static void builtin_pmap_chunk(lenv* e, int lo, int hi, void* ctx) {
+  builtin_par* p = ctx;
+  for (int i = lo; i < hi; i++) {
+    lval* y = builtin_par_item(e, p, i);
+    if (lval_type(y) != LVAL_ERR) { y = builtin_call(e, p->f, y, NULL); }
+    p->ys[i] = y;
+  }
+}
+
+static void builtin_preduce_chunk(lenv* e, int lo, int hi, void* ctx) {
+  builtin_par* p = ctx;
+  lval* z = builtin_par_item(e, p, lo);
+  for (int i = lo + 1; i < hi && lval_type(z) != LVAL_ERR; i++) {
+    lval* y = builtin_par_item(e, p, i);
+    if (lval_type(y) == LVAL_ERR) { lval_del(z); z = y; break; }
+    z = builtin_call(e, p->f, z, y);
+  }
+  p->ys[lo] = z;
+}
+
+/* Check the arguments of a parallel builtin and run it over the items */
+static lval* builtin_par_run(lenv* e, lval* a, char* func, int nargs,
+  lpar_fn fn, builtin_par* p, int* n) {
+  LASSERT_NUM(func, a, nargs);
+  LASSERT_TYPE(func, a, 0, LVAL_FUN);
+  LASSERT(a, lval_type(a->cell[nargs-1]) == LVAL_QEXPR
+    || lval_type(a->cell[nargs-1]) == LVAL_VEC,
+    "Function '%s' passed incorrect type for argument %i. "
+    "Got %s, Expected %s or %s.", func, nargs-1,
+    ltype_name(lval_type(a->cell[nargs-1])),
+    ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC));
+
+  p->f = a->cell[0];
+  p->l = a->cell[nargs-1];
+  p->xs = builtin_cells(p->l, n);
+  p->ys = calloc(*n ? *n : 1, sizeof(lval*));
+  lpar_run(e, *n, fn, p);
+  return NULL;
+}
+
+/* First error among the results in order, freeing all the others */
+static lval* builtin_par_err(builtin_par* p, int n) {
+  lval* err = NULL;
+  for (int i = 0; i < n && !err; i++) {
+    if (p->ys[i] && lval_type(p->ys[i]) == LVAL_ERR) { err = p->ys[i]; }
+  }
+  if (!err) { return NULL; }
+  for (int i = 0; i < n; i++) {
+    if (p->ys[i] && p->ys[i] != err) { lval_del(p->ys[i]); }
+  }
+  free(p->ys);
+  return err;
+}
+
+lval* builtin_pmap(lenv* e, lval* a) {
+  builtin_par p;
+  int n;
+  lval* err = builtin_par_run(e, a, "pmap", 2, builtin_pmap_chunk, &p, &n);
+  if (err) { return err; }
+  if ((err = builtin_par_err(&p, n))) { lval_del(a); return err; }
+
+  lval* x = lval_reserve(lval_qexpr(), n);
+  for (int i = 0; i < n; i++) { x->cell[x->count++] = p.ys[i]; }
+  if (lval_type(p.l) == LVAL_VEC) { x = lval_vec(x, 0, n); }
+  free(p.ys);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_pfilter(lenv* e, lval* a) {
+  builtin_par p;
+  int n;
+  lval* err = builtin_par_run(e, a, "pfilter", 2, builtin_pmap_chunk, &p, &n);
+  if (err) { return err; }
+  if ((err = builtin_par_err(&p, n))) { lval_del(a); return err; }
+
+  /* Conditions are tested as 'if' would, keeping items as written */
+  lval* x = lval_qexpr();
+  for (int i = 0; i < n; i++) {
+    if (!err && lval_type(p.ys[i]) != LVAL_NUM) {
+      err = lval_err("Function 'pfilter' passed function returning %s, "
+        "Expected %s.", ltype_name(lval_type(p.ys[i])), ltype_name(LVAL_NUM));
+    }
+    if (!err && lval_as_num(p.ys[i])) { lval_add(x, lval_copy(p.xs[i])); }
+    lval_del(p.ys[i]);
+  }
+  free(p.ys);
+  if (err) { lval_del(x); lval_del(a); return err; }
+
+  if (lval_type(p.l) == LVAL_VEC) { x = lval_vec(x, 0, x->count); }
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_preduce(lenv* e, lval* a) {
+  builtin_par p;
+  int n;
+  lval* err = builtin_par_run(e, a, "preduce", 3, builtin_preduce_chunk, &p, &n);
+  if (err) { return err; }
+  if ((err = builtin_par_err(&p, n))) { lval_del(a); return err; }
+
+  /* Results of the chunks are folded in order onto the initial value */
+  lval* z = lval_copy(a->cell[1]);
+  for (int i = 0; i < n; i++) {
+    if (!p.ys[i]) { continue; }
+    if (lval_type(z) == LVAL_ERR) { lval_del(p.ys[i]); continue; }
+    z = builtin_call(e, p.f, z, p.ys[i]);
+  }
+  free(p.ys);
+  lval_del(a);
+  return z;
+}
+static lval* builtin_fold_op(lenv* e, lval* a, char* func, char* op) {
+  LASSERT_NUM(func, a, 1);
+  LASSERT(a, lval_type(a->cell[0]) == LVAL_QEXPR
+    || lval_type(a->cell[0]) == LVAL_VEC,
+    "Function '%s' passed incorrect type for argument 0. "
+    "Got %s, Expected %s or %s.", func,
+    ltype_name(lval_type(a->cell[0])),
+    ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC));
+
+  int add = strcmp(op, "+") == 0;
+  lval* l = a->cell[0];
+  int n;
+  lval** xs = builtin_cells(l, &n);
+
+  /* Numbers are reduced by the kernels */
+  long x;
+  int status = add ? lnum_sum(xs, n, &x) : lnum_product(xs, n, &x);
+  LASSERT(a, status != LNUM_OVERFLOW, "Integer Overflow!");
+  if (status == LNUM_OK) {
+    lval_del(a);
+    return lval_num(x);
+  }
+
+  /* Otherwise items are evaluated first as the Lisp definition did */
+  x = add ? 0 : 1;
+  for (int i = 0; i < n; i++) {
+    lval* y = lval_type(l) == LVAL_VEC ? lval_copy(xs[i]) : builtin_item(e, xs[i]);
+    if (lval_type(y) == LVAL_ERR) { lval_del(a); return y; }
+    if (lval_type(y) != LVAL_NUM) {
+      lval* err = lval_err("Function '%s' passed incorrect type for argument %d. "
+        "Got %s, Expected %s.",
+        op, 1, ltype_name(lval_type(y)), ltype_name(LVAL_NUM));
+      lval_del(y); lval_del(a);
+      return err;
+    }
+    int ovf = add ? lnum_add(x, lval_as_num(y), &x)
+      : lnum_mul(x, lval_as_num(y), &x);
+    lval_del(y);
+    LASSERT(a, !ovf, "Integer Overflow!");
+  }
+
+  lval_del(a);
+  return lval_num(x);
+}
+
+lval* builtin_sum(lenv* e, lval* a) {
+  if (a->count < 1) { return builtin_partial(e, a, builtin_sum, "l"); }
+  return builtin_fold_op(e, a, "sum", "+");
+}
+
+lval* builtin_product(lenv* e, lval* a) {
+  if (a->count < 1) { return builtin_partial(e, a, builtin_product, "l"); }
+  return builtin_fold_op(e, a, "product", "*");
+}
+
+/* Check argument i is a list or vector of numbers */
+static lval* builtin_num_cells(lval* a, char* func, int i) {
+  lval* l = a->cell[i];
+  LASSERT(a, lval_type(l) == LVAL_QEXPR || lval_type(l) == LVAL_VEC,
+    "Function '%s' passed incorrect type for argument %i. "
+    "Got %s, Expected %s or %s.", func, i,
+    ltype_name(lval_type(l)), ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC));
+
+  int n;
+  lval** xs = builtin_cells(l, &n);
+  for (int j = 0; j < n; j++) {
+    LASSERT(a, lval_type(xs[j]) == LVAL_NUM,
+      "Function '%s' passed incorrect type for item %i of argument %i. "
+      "Got %s, Expected %s.", func, j, i,
+      ltype_name(lval_type(xs[j])), ltype_name(LVAL_NUM));
+  }
+  return NULL;
+}
+
+static lval* builtin_minmax(lenv* e, lval* a, char* func) {
+  LASSERT_NUM(func, a, 1);
+  lval* err = builtin_num_cells(a, func, 0);
+  if (err) { return err; }
+
+  int n;
+  lval** xs = builtin_cells(a->cell[0], &n);
+  LASSERT(a, n != 0, "Function '%s' passed {} for argument 0.", func);
+
+  long x;
+  if (strcmp(func, "min") == 0) { lnum_min(xs, n, &x); }
+  else { lnum_max(xs, n, &x); }
+  lval_del(a);
+  return lval_num(x);
+}
+
+lval* builtin_min(lenv* e, lval* a) {
+  return builtin_minmax(e, a, "min");
+}
+
+lval* builtin_max(lenv* e, lval* a) {
+  return builtin_minmax(e, a, "max");
+}
+
+/* Check both arguments are numbers of the same length */
+static lval* builtin_num_pair(lval* a, char* func) {
+  LASSERT_NUM(func, a, 2);
+  lval* err = builtin_num_cells(a, func, 0);
+  if (!err) { err = builtin_num_cells(a, func, 1); }
+  if (err) { return err; }
+
+  int n, m;
+  builtin_cells(a->cell[0], &n);
+  builtin_cells(a->cell[1], &m);
+  LASSERT(a, n == m,
+    "Function '%s' passed arguments of different lengths. "
+    "Got %i and %i.", func, n, m);
+  return NULL;
+}
+
+lval* builtin_dot(lenv* e, lval* a) {
+  lval* err = builtin_num_pair(a, "dot");
+  if (err) { return err; }
+
+  int n;
+  lval** xs = builtin_cells(a->cell[0], &n);
+  lval** ys = builtin_cells(a->cell[1], &n);
+
+  long x;
+  LASSERT(a, lnum_dot(xs, ys, n, &x) == LNUM_OK, "Integer Overflow!");
+  lval_del(a);
+  return lval_num(x);
+}
+
+/* Elementwise sum or product, of the same type as the first argument */
+static lval* builtin_elementwise(lenv* e, lval* a, char* func) {
+  lval* err = builtin_num_pair(a, func);
+  if (err) { return err; }
+
+  int n;
+  lval** xs = builtin_cells(a->cell[0], &n);
+  lval** ys = builtin_cells(a->cell[1], &n);
+
+  lval* x = lval_reserve(lval_qexpr(), n);
+  int status = strcmp(func, "vec-add") == 0
+    ? lnum_vadd(xs, ys, x->cell, n) : lnum_vmul(xs, ys, x->cell, n);
+  if (status != LNUM_OK) {
+    lval_del(x); lval_del(a);
+    return lval_err("Integer Overflow!");
+  }
+  x->count = n;
+
+  if (lval_type(a->cell[0]) == LVAL_VEC) { x = lval_vec(x, 0, n); }
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_vec_add(lenv* e, lval* a) {
+  return builtin_elementwise(e, a, "vec-add");
+}
+
+lval* builtin_vec_mul(lenv* e, lval* a) {
+  return builtin_elementwise(e, a, "vec-mul");
+}
+
+lval* builtin_vec(lenv* e, lval* a) {
+  lval* s = lval_own(a);
+  s->type = LVAL_QEXPR;
+  return lval_vec(s, 0, s->count);
+}
+
+lval* builtin_vec_len(lenv* e, lval* a) {
+  LASSERT_NUM("vec-len", a, 1);
+  LASSERT_TYPE("vec-len", a, 0, LVAL_VEC);
+
+  lval* x = lval_num(a->cell[0]->len);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_vec_ref(lenv* e, lval* a) {
+  LASSERT_NUM("vec-ref", a, 2);
+  LASSERT_TYPE("vec-ref", a, 0, LVAL_VEC);
+  LASSERT_TYPE("vec-ref", a, 1, LVAL_NUM);
+
+  lval* v = a->cell[0];
+  long i = lval_as_num(a->cell[1]);
+  LASSERT(a, i >= 0 && i < v->len,
+    "Function 'vec-ref' passed index %li out of range. "
+    "Vector has length %i.", i, v->len);
+
+  lval* x = lval_copy(lval_vec_cells(v)[i]);
+  lval_del(a);
+  return x;
+}
+
+/* Cells from 'start' up to 'end' share the backing list of the vector */
+lval* builtin_vec_slice(lenv* e, lval* a) {
+  LASSERT_NUM("vec-slice", a, 3);
+  LASSERT_TYPE("vec-slice", a, 0, LVAL_VEC);
+  LASSERT_TYPE("vec-slice", a, 1, LVAL_NUM);
+  LASSERT_TYPE("vec-slice", a, 2, LVAL_NUM);
+
+  lval* v = a->cell[0];
+  long start = lval_as_num(a->cell[1]);
+  long end = lval_as_num(a->cell[2]);
+  LASSERT(a, start >= 0 && start <= end && end <= v->len,
+    "Function 'vec-slice' passed range %li to %li out of range. "
+    "Vector has length %i.", start, end, v->len);
+
+  lval* x = lval_vec(lval_copy(v->store), v->start + start, end - start);
+  lval_del(a);
+  return x;
+}
+
+/* A vector ending where its backing list ends is appended to in place,
+ * as no other vector sharing the list views cells past that point.
+ * Otherwise its cells are copied to a new list first. */
+lval* builtin_vec_push(lenv* e, lval* a) {
+  LASSERT_NUM("vec-push", a, 2);
+  LASSERT_TYPE("vec-push", a, 0, LVAL_VEC);
+
+  lval* v = lval_own(lval_pop(a, 0));
+  lval* x = lval_take(a, 0);
+
+  /* Copy the cells unless v ends its store, which workers must not
+   * share while it grows and which is never grown in an image */
+  if (v->start + v->len != v->store->count || limg_contains(v->store)
+    || (lpar_active && lpar_shared(&v->store->refs))) {
+    lval* s = lval_qexpr();
+    for (int i = 0; i < v->len; i++) {
+      lval_add(s, lval_copy(lval_vec_cells(v)[i]));
+    }
+    lval_del(v->store);
+    v->store = s;
+    v->start = 0;
+  }
+
+  lval_add(v->store, x);
+  v->len++;
+  return v;
+}
+
+lval* builtin_vec_to_list(lenv* e, lval* a) {
+  LASSERT_NUM("vec->list", a, 1);
+  LASSERT_TYPE("vec->list", a, 0, LVAL_VEC);
+
+  lval* v = a->cell[0];
+  lval* x = lval_qexpr();
+  for (int i = 0; i < v->len; i++) {
+    lval_add(x, lval_copy(lval_vec_cells(v)[i]));
+  }
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_list_to_vec(lenv* e, lval* a) {
+  LASSERT_NUM("list->vec", a, 1);
+  LASSERT_TYPE("list->vec", a, 0, LVAL_QEXPR);
+
+  lval* s = lval_own(lval_take(a, 0));
+  return lval_vec(s, 0, s->count);
+}
+
+/* Keys are numbers, strings or symbols */
+static int builtin_is_key(lval* k) {
+  int t = lval_type(k);
+  return t == LVAL_NUM || t == LVAL_STR || t == LVAL_SYM;
+}
+
+#define LASSERT_KEY(func, args, index) \
+  LASSERT(args, builtin_is_key(args->cell[index]), \
+    "Function '%s' passed incorrect type for argument %i. " \
+    "Got %s, Expected Number, String or Symbol.", \
+    func, index, ltype_name(lval_type(args->cell[index])))
+
+/* Map of alternating keys and values */
+lval* builtin_hash(lenv* e, lval* a) {
+  LASSERT(a, a->count % 2 == 0,
+    "Function 'hash' passed an odd number of arguments. Got %i.", a->count);
+  for (int i = 0; i < a->count; i += 2) { LASSERT_KEY("hash", a, i); }
+
+  lval* m = lval_map();
+  for (int i = 0; i < a->count; i += 2) {
+    m = lmap_put(m, lval_copy(a->cell[i]), lval_copy(a->cell[i+1]));
+  }
+  lval_del(a);
+  return m;
+}
+
+lval* builtin_hash_size(lenv* e, lval* a) {
+  LASSERT_NUM("hash-size", a, 1);
+  LASSERT_TYPE("hash-size", a, 0, LVAL_MAP);
+
+  lval* x = lval_num(a->cell[0]->nkeys);
+  lval_del(a);
+  return x;
+}
+
+/* Value of a key, or of the third argument if given and the key is not
+ * present */
+lval* builtin_hash_get(lenv* e, lval* a) {
+  LASSERT(a, a->count == 2 || a->count == 3,
+    "Function 'hash-get' passed incorrect number of arguments. "
+    "Got %i, Expected 2 or 3.", a->count);
+  LASSERT_TYPE("hash-get", a, 0, LVAL_MAP);
+  LASSERT_KEY("hash-get", a, 1);
+
+  lval* x = lmap_get(a->cell[0], a->cell[1]);
+  if (!x) {
+    LASSERT(a, a->count == 3, "Key not found in hash map.");
+    x = a->cell[2];
+  }
+  x = lval_copy(x);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_hash_has(lenv* e, lval* a) {
+  LASSERT_NUM("hash-has", a, 2);
+  LASSERT_TYPE("hash-has", a, 0, LVAL_MAP);
+  LASSERT_KEY("hash-has", a, 1);
+
+  lval* x = lval_num(lmap_get(a->cell[0], a->cell[1]) != NULL);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_hash_set(lenv* e, lval* a) {
+  LASSERT_NUM("hash-set", a, 3);
+  LASSERT_TYPE("hash-set", a, 0, LVAL_MAP);
+  LASSERT_KEY("hash-set", a, 1);
+
+  lval* m = lval_pop(a, 0);
+  lval* k = lval_pop(a, 0);
+  return lmap_put(m, k, lval_take(a, 0));
+}
+
+lval* builtin_hash_del(lenv* e, lval* a) {
+  LASSERT_NUM("hash-del", a, 2);
+  LASSERT_TYPE("hash-del", a, 0, LVAL_MAP);
+  LASSERT_KEY("hash-del", a, 1);
+
+  lval* m = lval_pop(a, 0);
+  m = lmap_remove(m, a->cell[0]);
+  lval_del(a);
+  return m;
+}
+
+static void builtin_hash_key(lval* k, lval* v, void* x) {
+  lval_add(x, lval_copy(k));
+}
+
+static void builtin_hash_val(lval* k, lval* v, void* x) {
+  lval_add(x, lval_copy(v));
+}
+
+static void builtin_hash_item(lval* k, lval* v, void* x) {
+  lval* p = lval_reserve(lval_qexpr(), 2);
+  lval_add(p, lval_copy(k));
+  lval_add(p, lval_copy(v));
+  lval_add(x, p);
+}
+
+/* Keys, values or key value pairs of a map, in no particular order */
+static lval* builtin_hash_list(lval* a, char* func, lmap_visit f) {
+  LASSERT_NUM(func, a, 1);
+  LASSERT_TYPE(func, a, 0, LVAL_MAP);
+
+  lval* x = lval_reserve(lval_qexpr(), a->cell[0]->nkeys);
+  lmap_each(a->cell[0], f, x);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_hash_keys(lenv* e, lval* a) {
+  return builtin_hash_list(a, "hash-keys", builtin_hash_key);
+}
+
+lval* builtin_hash_vals(lenv* e, lval* a) {
+  return builtin_hash_list(a, "hash-vals", builtin_hash_val);
+}
+
+lval* builtin_hash_items(lenv* e, lval* a) {
+  return builtin_hash_list(a, "hash-items", builtin_hash_item);
+}
+
+/* A string as 'str' and 'format' show x: a string as it is, anything
+ * else as it is printed */
+static lval* builtin_render(lval* x) {
+  if (lval_type(x) == LVAL_STR) { return lval_copy(x); }
+  if (lval_type(x) == LVAL_NUM) {
+    char buf[32];
+    return lval_strn(buf, snprintf(buf, sizeof(buf), "%li", lval_as_num(x)));
+  }
+
+  char* s = NULL;
+  size_t n = 0;
+#ifndef _WIN32
+  FILE* f = open_memstream(&s, &n);
+  lval_fprint(f, x);
+  fclose(f);
+#else
+  FILE* f = tmpfile();
+  if (!f) { return lval_str(""); }
+  lval_fprint(f, x);
+  n = ftell(f);
+  rewind(f);
+  s = malloc(n);
+  n = fread(s, 1, n, f);
+  fclose(f);
+#endif
+  lval* v = lval_strn(s, n);
+  free(s);
+  return v;
+}
+
+/* Concatenation of the arguments, as rendered by to-string */
+lval* builtin_str(lenv* e, lval* a) {
+  if (a->count == 0) {
+    lval_del(a);
+    return lval_str("");
+  }
+  lval* x = builtin_render(a->cell[0]);
+  for (int i = 1; i < a->count; i++) {
+    lval* y = builtin_render(a->cell[i]);
+    x = lval_str_append(x, lval_str_data(y), y->slen);
+    lval_del(y);
+  }
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_to_string(lenv* e, lval* a) {
+  LASSERT_NUM("to-string", a, 1);
+  lval* x = builtin_render(a->cell[0]);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_str_len(lenv* e, lval* a) {
+  LASSERT_NUM("str-len", a, 1);
+  LASSERT_TYPE("str-len", a, 0, LVAL_STR);
+
+  lval* x = lval_num(a->cell[0]->slen);
+  lval_del(a);
+  return x;
+}
+
+/* Characters from 'start' up to 'end' share the buffer of the string */
+lval* builtin_substr(lenv* e, lval* a) {
+  LASSERT_NUM("substr", a, 3);
+  LASSERT_TYPE("substr", a, 0, LVAL_STR);
+  LASSERT_TYPE("substr", a, 1, LVAL_NUM);
+  LASSERT_TYPE("substr", a, 2, LVAL_NUM);
+
+  lval* s = a->cell[0];
+  long start = lval_as_num(a->cell[1]);
+  long end = lval_as_num(a->cell[2]);
+  LASSERT(a, start >= 0 && start <= end && end <= s->slen,
+    "Function 'substr' passed range %li to %li out of range. "
+    "String has length %li.", start, end, s->slen);
+
+  lval* x = lval_substr(s, start, end);
+  lval_del(a);
+  return x;
+}
+
+/* Parts of a string between occurrences of a separator */
+lval* builtin_str_split(lenv* e, lval* a) {
+  LASSERT_NUM("str-split", a, 2);
+  LASSERT_TYPE("str-split", a, 0, LVAL_STR);
+  LASSERT_TYPE("str-split", a, 1, LVAL_STR);
+  LASSERT(a, a->cell[1]->slen != 0,
+    "Function 'str-split' passed an empty separator.");
+
+  lval* s = a->cell[0];
+  char* c = lval_str_data(s);
+  char* sep = lval_str_data(a->cell[1]);
+  long n = a->cell[1]->slen;
+
+  lval* x = lval_qexpr();
+  long start = 0;
+  for (long i = 0; i + n <= s->slen; i++) {
+    if (memcmp(c + i, sep, n) == 0) {
+      lval_add(x, lval_substr(s, start, i));
+      start = i + n;
+      i += n - 1;
+    }
+  }
+  lval_add(x, lval_substr(s, start, s->slen));
+  lval_del(a);
+  return x;
+}
+
+/* Items of a list rendered by to-string with a separator between */
+lval* builtin_str_join(lenv* e, lval* a) {
+  LASSERT_NUM("str-join", a, 2);
+  LASSERT_TYPE("str-join", a, 0, LVAL_QEXPR);
+  LASSERT_TYPE("str-join", a, 1, LVAL_STR);
+
+  lval* l = a->cell[0];
+  lval* sep = a->cell[1];
+  lval* x = lval_str("");
+  for (int i = 0; i < l->count; i++) {
+    if (i) { x = lval_str_append(x, lval_str_data(sep), sep->slen); }
+    lval* y = builtin_render(l->cell[i]);
+    x = lval_str_append(x, lval_str_data(y), y->slen);
+    lval_del(y);
+  }
+  lval_del(a);
+  return x;
+}
+
+/* String with each '{}' in the first argument replaced by the next of
+ * the others, as rendered by to-string */
+lval* builtin_format(lenv* e, lval* a) {
+  LASSERT(a, a->count >= 1,
+    "Function 'format' passed incorrect number of arguments. "
+    "Got %i, Expected at least 1.", a->count);
+  LASSERT_TYPE("format", a, 0, LVAL_STR);
+
+  lval* fmt = a->cell[0];
+  char* c = lval_str_data(fmt);
+  lval* x = lval_str("");
+  long start = 0;
+  int arg = 1;
+  for (long i = 0; i + 1 < fmt->slen; i++) {
+    if (c[i] != '{' || c[i+1] != '}') { continue; }
+    if (arg == a->count) {
+      lval_del(x);
+      LASSERT(a, 0, "Function 'format' passed too few arguments. "
+        "Got %i.", a->count - 1);
+    }
+    x = lval_str_append(x, c + start, i - start);
+    lval* y = builtin_render(a->cell[arg++]);
+    x = lval_str_append(x, lval_str_data(y), y->slen);
+    lval_del(y);
+    start = i + 2;
+    i++;
+  }
+  if (arg != a->count) {
+    lval_del(x);
+    lval* err = lval_err("Function 'format' passed too many arguments. "
+      "Got %i, Expected %i.", a->count - 1, arg - 1);
+    lval_del(a);
+    return err;
+  }
+  x = lval_str_append(x, c + start, fmt->slen - start);
+  lval_del(a);
+  return x;
+}
+
 lval* builtin_var(lenv* e, lval* a, char* func) {
   LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
 
   lval* syms = a->cell[0];
   for (int i = 0; i < syms->count; i++) {
-    LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
+    LASSERT(a, (lval_type(syms->cell[i]) == LVAL_SYM),
       "Function '%s' cannot define non-symbol. "
       "Got %s, Expected %s.", func,
-      ltype_name(syms->cell[i]->type),
+      ltype_name(lval_type(syms->cell[i])),
       ltype_name(LVAL_SYM));
   }
 
@@ -93,7 +1009,16 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
     "Function '%s' passed too many arguments for symbols. "
     "Got %i, Expected %i.", func, a->count-1, syms->count);
 
+  /* The global environment is read only to parallel workers */
+  LASSERT(a, !lpar_worker || strcmp(func, "def") != 0,
+    "Function 'def' cannot be used by a parallel worker.");
+
   for (int i = 0; i < syms->count; i++) {
+    /* Functions are profiled under the first name they are bound to */
+    if (lprof_enabled && lval_type(a->cell[i+1]) == LVAL_FUN) {
+      lprof_name(a->cell[i+1], syms->cell[i]->sym);
+    }
+
     /* If 'def' define in globally. If 'put' define in locally */
     if (strcmp(func, "def") == 0) {
       lenv_def(e, syms->cell[i], a->cell[i+1]);
@@ -124,9 +1049,18 @@ lval* builtin_lambda(lenv* e, lval* a) {
 
   /* Check first Q-Expression contains only Symbols */
   for (int i = 0; i < a->cell[0]->count; i++) {
-    LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
+    LASSERT(a, (lval_type(a->cell[0]->cell[i]) == LVAL_SYM),
       "Cannot define non-symbol. Got %s, Expected %s.",
-      ltype_name(a->cell[0]->cell[i]->type),ltype_name(LVAL_SYM));
+      ltype_name(lval_type(a->cell[0]->cell[i])),ltype_name(LVAL_SYM));
+  }
+
+  /* Check no Symbol is bound twice, as arguments are bound by position */
+  for (int i = 0; i < a->cell[0]->count; i++) {
+    for (int j = 0; j < i; j++) {
+      LASSERT(a, (a->cell[0]->cell[i]->sym != a->cell[0]->cell[j]->sym
+        || a->cell[0]->cell[i]->sym == lsym_amp),
+        "Cannot define symbol '%s' twice.", a->cell[0]->cell[i]->sym);
+    }
   }
 
   /* Pop first two arguments and pass them to lval_lambda */
@@ -134,67 +1068,197 @@ lval* builtin_lambda(lenv* e, lval* a) {
   lval* body = lval_pop(a, 0);
   lval_del(a);
 
+  /* Resolve references to the formals to frame slots */
+  body = lval_resolve(formals, body);
+
   return lval_lambda(formals, body);
 }
 
-lval* builtin_op(lenv* e, lval* a, char* op) {
+/* Function remembering its results for up to the given number of
+ * distinct argument lists */
+lval* builtin_memo(lenv* e, lval* a) {
+  LASSERT(a, a->count == 1 || a->count == 2,
+    "Function 'memo' passed incorrect number of arguments. "
+    "Got %i, Expected 1 or 2.", a->count);
+  LASSERT_TYPE("memo", a, 0, LVAL_FUN);
+
+  long cap = LMEMO_DEFAULT_CAP;
+  if (a->count == 2) {
+    LASSERT_TYPE("memo", a, 1, LVAL_NUM);
+    cap = lval_as_num(a->cell[1]);
+    LASSERT(a, cap > 0 && cap <= INT_MAX,
+      "Function 'memo' passed invalid capacity %li.", cap);
+  }
+
+  lval* f = lval_own(lval_take(a, 0));
+  if (f->memo) { lmemo_del(f->memo); }
+  f->memo = lmemo_new(cap);
+  return f;
+}
+
+static lval* builtin_stat(char* name, long x) {
+  lval* v = lval_add(lval_qexpr(), lval_sym(name));
+  return lval_add(v, lval_num(x));
+}
 
-  /* Ensure all arguments are numbers */
-  for (int i = 0; i < a->count; i++) {
-    if (a->cell[i]->type != LVAL_NUM) {
-      lval* err = lval_err("Function '%s' passed incorrect type for argument %d. "
+lval* builtin_memo_stats(lenv* e, lval* a) {
+  LASSERT_NUM("memo-stats", a, 1);
+  LASSERT_TYPE("memo-stats", a, 0, LVAL_FUN);
+  LASSERT(a, a->cell[0]->memo,
+    "Function 'memo-stats' passed a function which is not memoized.");
+
+  lmemo* m = a->cell[0]->memo;
+  lval* v = lval_qexpr();
+  lval_add(v, builtin_stat("hits", m->hits));
+  lval_add(v, builtin_stat("misses", m->misses));
+  lval_add(v, builtin_stat("evictions", m->evictions));
+  lval_add(v, builtin_stat("size", m->count));
+  lval_add(v, builtin_stat("capacity", m->cap));
+  lval_del(a);
+  return v;
+}
+
+/* Runtime counters named in the list, or all of them if it is empty */
+lval* builtin_stats(lenv* e, lval* a) {
+  LASSERT_NUM("stats", a, 1);
+  LASSERT_TYPE("stats", a, 0, LVAL_QEXPR);
+  for (int i = 0; i < a->cell[0]->count; i++) {
+    LASSERT(a, lval_type(a->cell[0]->cell[i]) == LVAL_SYM,
+      "Function 'stats' cannot look up non-symbol. "
       "Got %s, Expected %s.",
-      op, i, ltype_name(a->cell[i]->type), ltype_name(LVAL_NUM));
-      lval_del(a);
-      return err;
-    }
+      ltype_name(lval_type(a->cell[0]->cell[i])), ltype_name(LVAL_SYM));
   }
 
-  /* Pop the first element */
-  lval* x = lval_pop(a, 0);
-
-  /* If no arguments and sub then perform unary negation */
-  if ((strcmp(op, "-") == 0) && a->count == 0) {
-    x->num = -x->num;
+  /* Read the counters before building the result changes them */
+  lstats s = *lstats_cur;
+  long allocs = 0, frees = 0;
+  for (int t = 0; t < LVAL_NTYPES; t++) {
+    allocs += s.allocs[t];
+    frees += s.frees[t];
   }
 
-  /* While there are still elements remaining */
-  while (a->count > 0) {
+  lval* v = lval_qexpr();
+  lval_add(v, builtin_stat("allocs", allocs));
+  lval_add(v, builtin_stat("frees", frees));
+  lval_add(v, builtin_stat("live", s.live));
+  lval_add(v, builtin_stat("peak", s.peak));
+  lval_add(v, builtin_stat("copies", s.copies));
+  lval_add(v, builtin_stat("copy-bytes", s.copy_bytes));
+  lval_add(v, builtin_stat("env-copies", s.env_copies));
+  lval_add(v, builtin_stat("env-copy-bytes", s.env_copy_bytes));
+  lval_add(v, builtin_stat("evals", s.evals));
+  lval_add(v, builtin_stat("vm-ops", s.ops));
+  lval_add(v, builtin_stat("calls", s.calls));
+  lval_add(v, builtin_stat("lookups", s.lookups));
+  lval_add(v, builtin_stat("probes", s.probes));
+  for (int t = 0; t < LVAL_NTYPES; t++) {
+    char name[32];
+    snprintf(name, sizeof(name), "allocs-%s", lstats_type_name(t));
+    lval_add(v, builtin_stat(name, s.allocs[t]));
+    snprintf(name, sizeof(name), "frees-%s", lstats_type_name(t));
+    lval_add(v, builtin_stat(name, s.frees[t]));
+  }
 
-    /* Pop the next element */
-    lval* y = lval_pop(a, 0);
+  if (a->cell[0]->count == 0) {
+    lval_del(a);
+    return v;
+  }
 
-    if (strcmp(op, "+") == 0) { x->num += y->num; }
-    if (strcmp(op, "-") == 0) { x->num -= y->num; }
-    if (strcmp(op, "*") == 0) { x->num *= y->num; }
-    if (strcmp(op, "/") == 0) {
-      if (y->num == 0) {
-        lval_del(x); lval_del(y);
-        x = lval_err("Division By Zero!"); break;
-      }
-      x->num /= y->num;
+  /* Symbols are interned so names compare by address */
+  lval* r = lval_qexpr();
+  for (int i = 0; i < a->cell[0]->count; i++) {
+    char* name = a->cell[0]->cell[i]->sym;
+    int j = 0;
+    while (j < v->count && v->cell[j]->cell[0]->sym != name) { j++; }
+    if (j == v->count) {
+      lval* err = lval_err("Function 'stats' has no counter '%s'.", name);
+      lval_del(r); lval_del(v); lval_del(a);
+      return err;
     }
-
-    lval_del(y);
+    lval_add(r, lval_copy(v->cell[j]));
   }
+  lval_del(v);
+  lval_del(a);
+  return r;
+}
 
-  lval_del(a); return x;
+/* Error for the first argument of an arithmetic builtin which is not a
+ * number, or otherwise for an overflowed result */
+static lval* builtin_num_err(lval* a, char* op) {
+  for (int i = 0; i < a->count; i++) {
+    if (lval_type(a->cell[i]) != LVAL_NUM) {
+      lval* err = lval_err("Function '%s' passed incorrect type for argument %d. "
+      "Got %s, Expected %s.",
+      op, i, ltype_name(lval_type(a->cell[i])), ltype_name(LVAL_NUM));
+      lval_del(a);
+      return err;
+    }
+  }
+  lval_del(a);
+  return lval_err("Integer Overflow!");
 }
 
 lval* builtin_add(lenv* e, lval* a) {
-  return builtin_op(e, a, "+");
+  long x;
+  if (lnum_sum(a->cell, a->count, &x) != LNUM_OK) {
+    return builtin_num_err(a, "+");
+  }
+  lval_del(a);
+  return lval_num(x);
 }
 
 lval* builtin_sub(lenv* e, lval* a) {
-  return builtin_op(e, a, "-");
+  LASSERT(a, a->count != 0,
+    "Function '-' passed incorrect number of arguments. Got 0.");
+  for (int i = 0; i < a->count; i++) {
+    if (lval_type(a->cell[i]) != LVAL_NUM) { return builtin_num_err(a, "-"); }
+  }
+
+  long x = lval_as_num(a->cell[0]);
+
+  /* If one argument then perform unary negation */
+  if (a->count == 1 && lnum_sub(0, x, &x)) { return builtin_num_err(a, "-"); }
+
+  for (int i = 1; i < a->count; i++) {
+    if (lnum_sub(x, lval_as_num(a->cell[i]), &x)) {
+      return builtin_num_err(a, "-");
+    }
+  }
+
+  lval_del(a);
+  return lval_num(x);
 }
 
 lval* builtin_mul(lenv* e, lval* a) {
-  return builtin_op(e, a, "*");
+  long x;
+  if (lnum_product(a->cell, a->count, &x) != LNUM_OK) {
+    return builtin_num_err(a, "*");
+  }
+  lval_del(a);
+  return lval_num(x);
 }
 
 lval* builtin_div(lenv* e, lval* a) {
-  return builtin_op(e, a, "/");
+  LASSERT(a, a->count != 0,
+    "Function '/' passed incorrect number of arguments. Got 0.");
+  for (int i = 0; i < a->count; i++) {
+    if (lval_type(a->cell[i]) != LVAL_NUM) { return builtin_num_err(a, "/"); }
+  }
+
+  long x = lval_as_num(a->cell[0]);
+
+  for (int i = 1; i < a->count; i++) {
+    long y = lval_as_num(a->cell[i]);
+    if (y == 0) {
+      lval_del(a);
+      return lval_err("Division By Zero!");
+    }
+    if (x == LONG_MIN && y == -1) { return builtin_num_err(a, "/"); }
+    x /= y;
+  }
+
+  lval_del(a);
+  return lval_num(x);
 }
 
 lval* builtin_ord(lenv* e, lval* a, char* op) {
@@ -204,16 +1268,16 @@ lval* builtin_ord(lenv* e, lval* a, char* op) {
 
   int r;
   if (strcmp(op, ">")  == 0) {
-    r = (a->cell[0]->num >  a->cell[1]->num);
+    r = (lval_as_num(a->cell[0]) >  lval_as_num(a->cell[1]));
   }
   if (strcmp(op, "<")  == 0) {
-    r = (a->cell[0]->num <  a->cell[1]->num);
+    r = (lval_as_num(a->cell[0]) <  lval_as_num(a->cell[1]));
   }
   if (strcmp(op, ">=") == 0) {
-    r = (a->cell[0]->num >= a->cell[1]->num);
+    r = (lval_as_num(a->cell[0]) >= lval_as_num(a->cell[1]));
   }
   if (strcmp(op, "<=") == 0) {
-    r = (a->cell[0]->num <= a->cell[1]->num);
+    r = (lval_as_num(a->cell[0]) <= lval_as_num(a->cell[1]));
   }
   lval_del(a);
   return lval_num(r);
@@ -257,65 +1321,120 @@ lval* builtin_ne(lenv* e, lval* a) {
   return builtin_cmp(e, a, "!=");
 }
 
-lval* builtin_if(lenv* e, lval* a) {
+/* Check the arguments of 'if' and return the branch it evaluates */
+lval* builtin_if_expr(lval* a) {
   LASSERT_NUM("if", a, 3);
   LASSERT_TYPE("if", a, 0, LVAL_NUM);
   LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
   LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
 
-  /* Mark Both Expressions as evaluable */
-  lval* x;
-  a->cell[1]->type = LVAL_SEXPR;
-  a->cell[2]->type = LVAL_SEXPR;
-
-  if (a->cell[0]->num) {
-    /* If condition is true evaluate first expression */
-    x = lval_eval(e, lval_pop(a, 1));
-  } else {
-    /* Otherwise evaluate second expression */
-    x = lval_eval(e, lval_pop(a, 2));
-  }
+  /* Pick the first expression if condition is true, else the second */
+  lval* x = lval_own(lval_pop(a, lval_as_num(a->cell[0]) ? 1 : 2));
 
-  /* Delete argument list and return */
+  /* Mark it as evaluable and delete argument list */
+  x->type = LVAL_SEXPR;
   lval_del(a);
   return x;
 }
 
+lval* builtin_if(lenv* e, lval* a) {
+  lval* x = builtin_if_expr(a);
+  if (lval_type(x) == LVAL_ERR) { return x; }
+  return lval_eval(e, x);
+}
+
+/* Contents of a file, mapped into memory where possible. Sets 'mapped'
+ * to say which, and returns NULL if the file cannot be read. */
+char* builtin_load_open(char* name, long* length, int* mapped) {
+  *mapped = 0;
+
+#ifndef _WIN32
+  int fd = open(name, O_RDONLY);
+  if (fd < 0) { return NULL; }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    char* input = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (input != MAP_FAILED) {
+      /* Forms are read front to back */
+      posix_madvise(input, st.st_size, POSIX_MADV_SEQUENTIAL);
+      close(fd);
+      *length = st.st_size;
+      *mapped = 1;
+      return input;
+    }
+  }
+  close(fd);
+#endif
+
+  /* Otherwise read the whole file into a buffer */
+  FILE* f = fopen(name, "rb");
+  if (f == NULL) { return NULL; }
+
+  long size = 0;
+  long cap = 4096;
+  char* input = malloc(cap);
+  size_t got;
+  while (input && (got = fread(input + size, 1, cap - size, f)) > 0) {
+    size += got;
+    if (size == cap) {
+      cap *= 2;
+      char* grown = realloc(input, cap);
+      if (!grown) { free(input); }
+      input = grown;
+    }
+  }
+
+  /* A directory opens but cannot be read */
+  if (input && ferror(f)) {
+    free(input);
+    input = NULL;
+  }
+  fclose(f);
+
+  *length = size;
+  return input;
+}
+
+void builtin_load_close(char* input, long length, int mapped) {
+#ifndef _WIN32
+  if (mapped) { munmap(input, length); return; }
+#endif
+  free(input);
+}
+
 lval* builtin_load(lenv* e, lval* a) {
   LASSERT_NUM("load", a, 1);
   LASSERT_TYPE("load", a, 0, LVAL_STR);
 
   /* Open file and check it exists */
-  FILE* f = fopen(a->cell[0]->str, "rb");
-  if (f == NULL) {
-    lval* err = lval_err("Could not load Library %s", a->cell[0]->str);
+  long length;
+  int mapped;
+  char* name = lval_str_cstr(a->cell[0]);
+  char* input = builtin_load_open(name, &length, &mapped);
+  if (input == NULL) {
+    lval* err = lval_err("Could not load Library %s", name);
+    free(name);
     lval_del(a);
     return err;
   }
+  free(name);
 
-  /* Read File Contents */
-  fseek(f, 0, SEEK_END);
-  long length = ftell(f);
-  fseek(f, 0, SEEK_SET);
-  char* input = calloc(length+1, 1);
-  fread(input, 1, length, f);
-  fclose(f);
+  /* Read and evaluate one top level form at a time, so only the form
+   * being evaluated is held in memory. A read error ends the file. */
+  long i = lval_read_space(input, 0, length);
+  while (i < length) {
+    lval* expr = lval_sexpr();
+    i = lval_read_form(expr, input, i, length);
 
-  lval* expr = lval_sexpr();
-  lval_read_expr(expr, input, 0, '\0');
+    lval* x = lval_eval(e, lval_take(expr, 0));
+    if (lval_type(x) == LVAL_ERR) { lval_println(x); }
+    lval_del(x);
 
-  /* Evaluate all expressions contained in S-Expr */
-  if (expr->type != LVAL_ERR) {
-    while (expr->count) {
-      lval* x = lval_eval(e, lval_pop(expr, 0));
-      if (x->type == LVAL_ERR) { lval_println(x); }
-      lval_del(x);
-    }
-  } else {
-    lval_println(expr);
+    i = lval_read_space(input, i, length);
   }
 
-  lval_del(expr);
+  builtin_load_close(input, length, mapped);
 
   lval_del(a);
 
@@ -341,9 +1460,98 @@ lval* builtin_error(lenv* e, lval* a) {
   LASSERT_TYPE("error", a, 0, LVAL_STR);
 
   /* Construct Error from first argument */
-  lval* err = lval_err(a->cell[0]->str);
+  lval* err = lval_err("%.*s", (int)a->cell[0]->slen,
+    lval_str_data(a->cell[0]));
 
   /* Delete arguments and return */
   lval_del(a);
   return err;
-}
\ No newline at end of file
+}
+
+void lenv_add_builtins(lenv* e) {
+  /* List Functions */
+  lenv_add_builtin(e, "list", builtin_list);
+  lenv_add_builtin(e, "head", builtin_head);
+  lenv_add_builtin(e, "tail", builtin_tail);
+  lenv_add_builtin(e, "eval", builtin_eval);
+  lenv_add_builtin(e, "join", builtin_join);
+  lenv_add_builtin(e, "len", builtin_len);
+  lenv_add_builtin(e, "nth", builtin_nth);
+  lenv_add_builtin(e, "take", builtin_take);
+  lenv_add_builtin(e, "drop", builtin_drop);
+  lenv_add_builtin(e, "elem", builtin_elem);
+  lenv_add_builtin(e, "map", builtin_map);
+  lenv_add_builtin(e, "filter", builtin_filter);
+  lenv_add_builtin(e, "foldl", builtin_foldl);
+  lenv_add_builtin(e, "pmap", builtin_pmap);
+  lenv_add_builtin(e, "pfilter", builtin_pfilter);
+  lenv_add_builtin(e, "preduce", builtin_preduce);
+  lenv_add_builtin(e, "sum", builtin_sum);
+  lenv_add_builtin(e, "product", builtin_product);
+
+  /* Vector Functions */
+  lenv_add_builtin(e, "vec", builtin_vec);
+  lenv_add_builtin(e, "vec-len", builtin_vec_len);
+  lenv_add_builtin(e, "vec-ref", builtin_vec_ref);
+  lenv_add_builtin(e, "vec-slice", builtin_vec_slice);
+  lenv_add_builtin(e, "vec-push", builtin_vec_push);
+  lenv_add_builtin(e, "vec->list", builtin_vec_to_list);
+  lenv_add_builtin(e, "list->vec", builtin_list_to_vec);
+  lenv_add_builtin(e, "vec-add", builtin_vec_add);
+  lenv_add_builtin(e, "vec-mul", builtin_vec_mul);
+
+  /* Hash Map Functions */
+  lenv_add_builtin(e, "hash", builtin_hash);
+  lenv_add_builtin(e, "hash-size", builtin_hash_size);
+  lenv_add_builtin(e, "hash-get", builtin_hash_get);
+  lenv_add_builtin(e, "hash-has", builtin_hash_has);
+  lenv_add_builtin(e, "hash-set", builtin_hash_set);
+  lenv_add_builtin(e, "hash-del", builtin_hash_del);
+  lenv_add_builtin(e, "hash-keys", builtin_hash_keys);
+  lenv_add_builtin(e, "hash-vals", builtin_hash_vals);
+  lenv_add_builtin(e, "hash-items", builtin_hash_items);
+
+  /* '(hash)' is the builtin itself, so the empty map is bound by name */
+  lval* k = lval_sym("hash-empty");
+  lval* m = lval_map();
+  lenv_put(e, k, m);
+  lval_del(k); lval_del(m);
+
+  /* String Functions */
+  lenv_add_builtin(e, "str", builtin_str);
+  lenv_add_builtin(e, "to-string", builtin_to_string);
+  lenv_add_builtin(e, "str-len", builtin_str_len);
+  lenv_add_builtin(e, "substr", builtin_substr);
+  lenv_add_builtin(e, "str-split", builtin_str_split);
+  lenv_add_builtin(e, "str-join", builtin_str_join);
+  lenv_add_builtin(e, "format", builtin_format);
+
+  lenv_add_builtin(e, "def",  builtin_def);
+  lenv_add_builtin(e, "\\", builtin_lambda);
+  lenv_add_builtin(e, "=",   builtin_put);
+  lenv_add_builtin(e, "memo", builtin_memo);
+  lenv_add_builtin(e, "memo-stats", builtin_memo_stats);
+  lenv_add_builtin(e, "stats", builtin_stats);
+
+  /* Mathematical Functions */
+  lenv_add_builtin(e, "+", builtin_add);
+  lenv_add_builtin(e, "-", builtin_sub);
+  lenv_add_builtin(e, "*", builtin_mul);
+  lenv_add_builtin(e, "/", builtin_div);
+  lenv_add_builtin(e, "min", builtin_min);
+  lenv_add_builtin(e, "max", builtin_max);
+  lenv_add_builtin(e, "dot", builtin_dot);
+
+  /* Comparison Functions */
+  lenv_add_builtin(e, "if", builtin_if);
+  lenv_add_builtin(e, "==", builtin_eq);
+  lenv_add_builtin(e, "!=", builtin_ne);
+  lenv_add_builtin(e, ">",  builtin_gt);
+  lenv_add_builtin(e, "<",  builtin_lt);
+  lenv_add_builtin(e, ">=", builtin_ge);
+  lenv_add_builtin(e, "<=", builtin_le);
+
+  lenv_add_builtin(e, "load", builtin_load);
+  lenv_add_builtin(e, "print", builtin_print);
+  lenv_add_builtin(e, "error", builtin_error);
+}
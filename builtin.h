@@ -5,10 +5,55 @@ lval* builtin_head(lenv* e, lval* a);
 lval* builtin_tail(lenv* e, lval* a);
 lval* builtin_list(lenv* e, lval* a);
 lval* builtin_eval(lenv* e, lval* a);
+lval* builtin_eval_expr(lval* a);
 lval* builtin_join(lenv* e, lval* a);
+lval* builtin_len(lenv* e, lval* a);
+lval* builtin_nth(lenv* e, lval* a);
+lval* builtin_take(lenv* e, lval* a);
+lval* builtin_drop(lenv* e, lval* a);
+lval* builtin_elem(lenv* e, lval* a);
+lval* builtin_map(lenv* e, lval* a);
+lval* builtin_filter(lenv* e, lval* a);
+lval* builtin_foldl(lenv* e, lval* a);
+lval* builtin_pmap(lenv* e, lval* a);
+lval* builtin_pfilter(lenv* e, lval* a);
+lval* builtin_preduce(lenv* e, lval* a);
+lval* builtin_sum(lenv* e, lval* a);
+lval* builtin_product(lenv* e, lval* a);
+lval* builtin_min(lenv* e, lval* a);
+lval* builtin_max(lenv* e, lval* a);
+lval* builtin_dot(lenv* e, lval* a);
+lval* builtin_vec_add(lenv* e, lval* a);
+lval* builtin_vec_mul(lenv* e, lval* a);
+lval* builtin_vec(lenv* e, lval* a);
+lval* builtin_vec_len(lenv* e, lval* a);
+lval* builtin_vec_ref(lenv* e, lval* a);
+lval* builtin_vec_slice(lenv* e, lval* a);
+lval* builtin_vec_push(lenv* e, lval* a);
+lval* builtin_vec_to_list(lenv* e, lval* a);
+lval* builtin_list_to_vec(lenv* e, lval* a);
+lval* builtin_hash(lenv* e, lval* a);
+lval* builtin_hash_size(lenv* e, lval* a);
+lval* builtin_hash_get(lenv* e, lval* a);
+lval* builtin_hash_has(lenv* e, lval* a);
+lval* builtin_hash_set(lenv* e, lval* a);
+lval* builtin_hash_del(lenv* e, lval* a);
+lval* builtin_hash_keys(lenv* e, lval* a);
+lval* builtin_hash_vals(lenv* e, lval* a);
+lval* builtin_hash_items(lenv* e, lval* a);
+lval* builtin_str(lenv* e, lval* a);
+lval* builtin_to_string(lenv* e, lval* a);
+lval* builtin_str_len(lenv* e, lval* a);
+lval* builtin_substr(lenv* e, lval* a);
+lval* builtin_str_split(lenv* e, lval* a);
+lval* builtin_str_join(lenv* e, lval* a);
+lval* builtin_format(lenv* e, lval* a);
 lval* builtin_def(lenv* e, lval* a);
 lval* builtin_put(lenv* e, lval* a);
 lval* builtin_lambda(lenv* e, lval* a);
+lval* builtin_memo(lenv* e, lval* a);
+lval* builtin_memo_stats(lenv* e, lval* a);
+lval* builtin_stats(lenv* e, lval* a);
 lval* builtin_add(lenv* e, lval* a);
 lval* builtin_sub(lenv* e, lval* a);
 lval* builtin_mul(lenv* e, lval* a);
@@ -20,8 +65,16 @@ lval* builtin_le(lenv* e, lval* a);
 lval* builtin_eq(lenv* e, lval* a);
 lval* builtin_ne(lenv* e, lval* a);
 lval* builtin_if(lenv* e, lval* a);
+lval* builtin_if_expr(lval* a);
 lval* builtin_load(lenv* e, lval* a);
+
+/* Contents of the file 'name', or NULL if it cannot be read, released
+ * with builtin_load_close */
+char* builtin_load_open(char* name, long* length, int* mapped);
+void builtin_load_close(char* input, long length, int mapped);
 lval* builtin_print(lenv* e, lval* a);
 lval* builtin_error(lenv* e, lval* a);
 
+void lenv_add_builtins(lenv* e);
+
 #endif
@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lispy.h"
+#include "lenv.h"
+#include "lval.h"
+#include "lgc.h"
+#include "lsym.h"
+#include "lstr.h"
+#include "lstats.h"
+#include "builtin.h"
+
+/* Type numbers are those of lval */
+typedef char lapi_types_match[(int)LISPY_MAP == (int)LVAL_MAP ? 1 : -1];
+
+struct lispy {
+  lenv* env;
+  lgc_heap heap;
+  lstats stats;
+  lsym_table* syms;
+};
+
+/* State of the thread before an interpreter was entered */
+typedef struct {
+  lgc_heap* heap;
+  lstats* stats;
+  lsym_table* syms;
+} lapi_saved;
+
+static void lapi_enter(lispy* L, lapi_saved* s) {
+  s->heap = lgc_cur;
+  s->stats = lstats_cur;
+  s->syms = lsym_cur;
+  lgc_cur = &L->heap;
+  lstats_cur = &L->stats;
+  lsym_cur = L->syms;
+}
+
+static void lapi_leave(lapi_saved* s) {
+  lgc_cur = s->heap;
+  lstats_cur = s->stats;
+  lsym_cur = s->syms;
+}
+
+lispy* lispy_new(void) {
+  lispy* L = calloc(1, sizeof(lispy));
+  lgc_heap_init(&L->heap);
+  L->syms = lsym_table_new();
+
+  lapi_saved s;
+  lapi_enter(L, &s);
+  L->env = lenv_new();
+  lenv_add_builtins(L->env);
+  lapi_leave(&s);
+  return L;
+}
+
+void lispy_free(lispy* L) {
+  lapi_saved s;
+  lapi_enter(L, &s);
+  lenv_del(L->env);
+
+  /* Values only referenced by each other are left to the collector */
+  lgc_collect();
+  lapi_leave(&s);
+
+  /* Caches of the thread, which may end once its interpreter is gone */
+  lenv_trim();
+  lval_read_trim();
+
+  lsym_table_del(L->syms);
+  free(L);
+}
+
+/* Evaluate the n characters of src one top level form at a time */
+static lval* lapi_eval(lispy* L, char* src, long n) {
+  lval* x = lval_sexpr();
+  long i = lval_read_space(src, 0, n);
+  while (i < n) {
+    lval* expr = lval_sexpr();
+    i = lval_read_form(expr, src, i, n);
+
+    lval_del(x);
+    x = lval_eval(L->env, lval_take(expr, 0));
+    if (lval_type(x) == LVAL_ERR) { break; }
+
+    i = lval_read_space(src, i, n);
+  }
+  return x;
+}
+
+lispy_val* lispy_eval_string(lispy* L, const char* src) {
+  lapi_saved s;
+  lapi_enter(L, &s);
+  lval* x = lapi_eval(L, (char*)src, strlen(src));
+  lapi_leave(&s);
+  return x;
+}
+
+lispy_val* lispy_load(lispy* L, const char* path) {
+  lapi_saved s;
+  lapi_enter(L, &s);
+
+  lval* x;
+  long n;
+  int mapped;
+  char* src = builtin_load_open((char*)path, &n, &mapped);
+  if (!src) {
+    x = lval_err("Could not load Library %s", path);
+  } else {
+    x = lapi_eval(L, src, n);
+    builtin_load_close(src, n, mapped);
+  }
+
+  lapi_leave(&s);
+  return x;
+}
+
+void lispy_release(lispy* L, lispy_val* v) {
+  lapi_saved s;
+  lapi_enter(L, &s);
+  lval_del(v);
+  lapi_leave(&s);
+}
+
+int lispy_type(lispy_val* v) {
+  return lval_type(v);
+}
+
+long lispy_num(lispy_val* v) {
+  return lval_type(v) == LVAL_NUM ? lval_as_num(v) : 0;
+}
+
+const char* lispy_str(lispy_val* v, long* len) {
+  if (lval_type(v) != LVAL_STR) { *len = 0; return NULL; }
+  *len = v->slen;
+  return lval_str_data(v);
+}
+
+const char* lispy_sym(lispy_val* v) {
+  return lval_type(v) == LVAL_SYM ? v->sym : NULL;
+}
+
+const char* lispy_err(lispy_val* v) {
+  return lval_type(v) == LVAL_ERR ? v->err : NULL;
+}
+
+int lispy_len(lispy_val* v) {
+  switch (lval_type(v)) {
+    case LVAL_SEXPR:
+    case LVAL_QEXPR: return v->count;
+    case LVAL_VEC: return v->len;
+    default: return 0;
+  }
+}
+
+lispy_val* lispy_item(lispy_val* v, int i) {
+  if (i < 0 || i >= lispy_len(v)) { return NULL; }
+  return lval_type(v) == LVAL_VEC ? lval_vec_cells(v)[i] : v->cell[i];
+}
+
+void lispy_print(lispy* L, lispy_val* v, FILE* f) {
+  lapi_saved s;
+  lapi_enter(L, &s);
+  lval_fprint(f, v);
+  lapi_leave(&s);
+}
+
+void lispy_print_stats(lispy* L, FILE* f) {
+  lstats_print(&L->stats, f);
+}
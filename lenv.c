@@ -1,85 +1,208 @@
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include "lenv.h"
 #include "lval.h"
+#include "lprof.h"
+#include "lstats.h"
+#include "lpar.h"
 
 
+/* Deleted frames kept for reuse by each thread, as one is made for
+ * every lambda call */
+#define LENV_FREE_MAX 64
+static LTHREAD lenv* lenv_free[LENV_FREE_MAX];
+static LTHREAD int lenv_nfree = 0;
+
 lenv* lenv_new(void) {
-  lenv* e = malloc(sizeof(lenv));
+  lenv* e = lenv_nfree ? lenv_free[--lenv_nfree] : malloc(sizeof(lenv));
   e->par = NULL;
   e->count = 0;
-  e->syms = NULL;
-  e->vals = NULL;
+  e->cap = LENV_INLINE;
+  e->syms = e->inline_syms;
+  e->vals = e->inline_vals;
+  e->index = NULL;
+  e->index_cap = 0;
   return e;
 }
 
 void lenv_del(lenv* e) {
   for (int i = 0; i < e->count; i++) {
-    free(e->syms[i]);
     lval_del(e->vals[i]);
   }
-  free(e->syms);
-  free(e->vals);
-  free(e);
+  if (e->syms != e->inline_syms) {
+    free(e->syms);
+    free(e->vals);
+  }
+  free(e->index);
+  if (lenv_nfree < LENV_FREE_MAX) {
+    lenv_free[lenv_nfree++] = e;
+  } else {
+    free(e);
+  }
+}
+
+/* Free the frames kept by this thread */
+void lenv_trim(void) {
+  while (lenv_nfree) { free(lenv_free[--lenv_nfree]); }
+}
+
+/* Hash an interned name by its address */
+static unsigned long lenv_hash(char* sym) {
+  uintptr_t h = (uintptr_t)sym >> 3;
+  return (unsigned long)(h * 0x9E3779B97F4A7C15ULL >> 16);
+}
+
+/* Index slots hold entry position plus one so zero marks an empty slot */
+static void lenv_index_insert(lenv* e, int i) {
+  unsigned long mask = e->index_cap - 1;
+  unsigned long j = lenv_hash(e->syms[i]) & mask;
+  while (e->index[j]) { j = (j + 1) & mask; }
+  e->index[j] = i + 1;
+}
+
+static void lenv_index_rebuild(lenv* e) {
+  /* Size the index to at least twice the capacity of the entries */
+  int cap = 16;
+  while (cap < e->cap * 2) { cap *= 2; }
+  free(e->index);
+  e->index = calloc(cap, sizeof(int));
+  e->index_cap = cap;
+  for (int i = 0; i < e->count; i++) {
+    lenv_index_insert(e, i);
+  }
+}
+
+/* Position of name in this frame only, or -1 */
+static int lenv_find(lenv* e, char* sym) {
+  if (!e->index) {
+    for (int i = 0; i < e->count; i++) {
+      if (e->syms[i] == sym) { return i; }
+    }
+    return -1;
+  }
+
+  unsigned long mask = e->index_cap - 1;
+  unsigned long j = lenv_hash(sym) & mask;
+  while (e->index[j]) {
+    int i = e->index[j] - 1;
+    if (e->syms[i] == sym) { return i; }
+    j = (j + 1) & mask;
+  }
+  return -1;
+}
+
+static void lenv_grow(lenv* e) {
+  int cap = e->cap * 2;
+  if (e->syms == e->inline_syms) {
+    e->syms = malloc(sizeof(char*) * cap);
+    e->vals = malloc(sizeof(lval*) * cap);
+    memcpy(e->syms, e->inline_syms, sizeof(char*) * e->count);
+    memcpy(e->vals, e->inline_vals, sizeof(lval*) * e->count);
+  } else {
+    e->syms = realloc(e->syms, sizeof(char*) * cap);
+    e->vals = realloc(e->vals, sizeof(lval*) * cap);
+  }
+  e->cap = cap;
+}
+
+static void lenv_append(lenv* e, char* sym, lval* v) {
+  if (e->count == e->cap) { lenv_grow(e); }
+
+  e->vals[e->count] = v;
+  e->syms[e->count] = sym;
+  e->count++;
+
+  /* Keep index load factor at or below one half */
+  if (e->index && e->count * 2 <= e->index_cap) {
+    lenv_index_insert(e, e->count-1);
+  } else if (e->count > LENV_SCAN_MAX) {
+    lenv_index_rebuild(e);
+  }
 }
 
 lenv* lenv_copy(lenv* e) {
-  lenv* n = malloc(sizeof(lenv));
+  lenv* n = lenv_new();
   n->par = e->par;
+  while (n->cap < e->count) { lenv_grow(n); }
   n->count = e->count;
-  n->syms = malloc(sizeof(char*) * n->count);
-  n->vals = malloc(sizeof(lval*) * n->count);
+  LSTATS_INC(env_copies);
+  LSTATS_ADD(env_copy_bytes,
+    sizeof(lenv) + (sizeof(char*) + sizeof(lval*)) * e->count);
   for (int i = 0; i < e->count; i++) {
-    n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-    strcpy(n->syms[i], e->syms[i]);
+    n->syms[i] = e->syms[i];
     n->vals[i] = lval_copy(e->vals[i]);
   }
+  if (e->index) { lenv_index_rebuild(n); }
   return n;
 }
 
-lval* lenv_get(lenv* e, lval* k) {
+/* Value bound to k, or NULL, counting the frames searched into n */
+static lval* lenv_lookup(lenv* e, lval* k, long* n) {
 
-  /* Iterate over all items in environment */
-  for (int i = 0; i < e->count; i++) {
-    /* Check if the stored string matches the symbol string */
-    /* If it does, return a copy of the value */
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      return lval_copy(e->vals[i]);
+  /* Try the lexical address first, names bound in frames passed on
+   * the way still shadow it as frames are chained at call time */
+  if (k->depth >= 0) {
+    for (int d = 0; e && d < k->depth; d++, e = e->par) {
+      (*n)++;
+      int i = lenv_find(e, k->sym);
+      if (i >= 0) { return e->vals[i]; }
+    }
+    (*n)++;
+    if (e && k->slot < e->count && e->syms[k->slot] == k->sym) {
+      return e->vals[k->slot];
     }
   }
 
-  /* If no symbol check in parent otherwise error */
-  if (e->par) {
-    return lenv_get(e->par, k);
-  } else {
-    return lval_err("Unbound Symbol '%s'", k->sym);
+  /* Search each frame from innermost to outermost */
+  for (; e; e = e->par) {
+    (*n)++;
+    int i = lenv_find(e, k->sym);
+    if (i >= 0) { return e->vals[i]; }
   }
+  return NULL;
+}
+
+lval* lenv_get(lenv* e, lval* k) {
+  long n = 0;
+  lval* v = lenv_lookup(e, k, &n);
+  LSTATS_INC(lookups);
+  LSTATS_ADD(probes, n);
+
+  /* If found return a copy of the value */
+  if (v) { return lval_copy(v); }
+  return lval_err("Unbound Symbol '%s'", k->sym);
 }
 
 void lenv_put(lenv* e, lval* k, lval* v) {
 
-  /* Iterate over all items in environment */
-  /* This is to see if variable already exists */
-  for (int i = 0; i < e->count; i++) {
+  /* See if variable already exists */
+  int i = lenv_find(e, k->sym);
 
-    /* If variable is found delete item at that position */
-    /* And replace with variable supplied by user */
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      lval_del(e->vals[i]);
-      e->vals[i] = lval_copy(v);
-      return;
-    }
+  /* If variable is found delete item at that position */
+  /* And replace with variable supplied by user */
+  if (i >= 0) {
+    lval_del(e->vals[i]);
+    e->vals[i] = lval_copy(v);
+    return;
   }
 
-  /* If no existing entry found allocate space for new entry */
-  e->count++;
-  e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-  e->syms = realloc(e->syms, sizeof(char*) * e->count);
+  /* If no existing entry found add a copy in a new entry */
+  lenv_append(e, k->sym, lval_copy(v));
+}
 
-  /* Copy contents of lval and symbol string into new location */
-  e->vals[e->count-1] = lval_copy(v);
-  e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-  strcpy(e->syms[e->count-1], k->sym);
+/* Bind v to the next slot without searching or copying. Used for lambda
+ * arguments, which are bound in the order of the formals. */
+void lenv_bind(lenv* e, lval* k, lval* v) {
+  lenv_append(e, k->sym, v);
+}
+
+/* Whether every name bound in 'outer' is also bound in 'e' */
+int lenv_shadows(lenv* e, lenv* outer) {
+  for (int i = 0; i < outer->count; i++) {
+    if (lenv_find(e, outer->syms[i]) < 0) { return 0; }
+  }
+  return 1;
 }
 
 void lenv_def(lenv* e, lval* k, lval* v) {
@@ -92,6 +215,7 @@ void lenv_def(lenv* e, lval* k, lval* v) {
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
   lval* k = lval_sym(name);
   lval* v = lval_fun(func);
+  if (lprof_enabled) { lprof_name(v, name); }
   lenv_put(e, k, v);
   lval_del(k); lval_del(v);
 }
@@ -6,18 +6,36 @@
 struct lenv;
 typedef struct lenv lenv;
 
+/* Frames up to this many entries are searched linearly */
+#define LENV_SCAN_MAX 8
+
+/* Entries stored inside the lenv itself before spilling to the heap */
+#define LENV_INLINE 4
+
 struct lenv {
   lenv* par;
   int count;
-  char** syms;
+  int cap;
+  char** syms; /* Interned symbol names */
   lval** vals;
+
+  /* Open addressing index into syms/vals, built for large frames */
+  int* index;
+  int index_cap;
+
+  /* Inline storage used by small frames such as lambda arguments */
+  char* inline_syms[LENV_INLINE];
+  lval* inline_vals[LENV_INLINE];
 };
 
 lenv* lenv_new(void);
 void lenv_del(lenv* e);
+void lenv_trim(void);
 lenv* lenv_copy(lenv* e);
 lval* lenv_get(lenv* e, lval* k);
 void lenv_put(lenv* e, lval* k, lval* v);
+void lenv_bind(lenv* e, lval* k, lval* v);
+int lenv_shadows(lenv* e, lenv* outer);
 void lenv_def(lenv* e, lval* k, lval* v);
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func);
 
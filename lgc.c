@@ -0,0 +1,298 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lgc.h"
+#include "lenv.h"
+#include "lpool.h"
+#include "lvm.h"
+#include "lmemo.h"
+#include "lstats.h"
+
+/* Collect once this many lists and functions were allocated since the
+ * last collection, or as many as survived it if that is larger */
+#define LGC_MIN_THRESHOLD 10000
+
+/* gc_refs value of values found reachable during a collection */
+#define LGC_REACHABLE -1
+
+int lgc_stats = 0;
+
+static lgc_heap lgc_main = {
+  .head = { .gc_prev = &lgc_main.head, .gc_next = &lgc_main.head },
+  .threshold = LGC_MIN_THRESHOLD
+};
+LTHREAD lgc_heap* lgc_cur = &lgc_main;
+
+/* Lists, vectors, maps and functions may hold references to other
+ * values */
+static int lgc_type_tracked(int type) {
+  return type == LVAL_SEXPR || type == LVAL_QEXPR || type == LVAL_FUN
+    || type == LVAL_VEC || type == LVAL_MAP || type == LVAL_MAPNODE;
+}
+
+static int lgc_is_tracked(lval* v) {
+  return !lval_is_fixnum(v) && lgc_type_tracked(v->type);
+}
+
+/* Values restored from an image are in no heap and never collected */
+static int lgc_in_heap(lval* v) {
+  return lgc_is_tracked(v) && v->gc_next;
+}
+
+/* Untracked values are allocated without the collector fields */
+size_t lgc_size(int type) {
+  return lgc_type_tracked(type) ? sizeof(lval) : LVAL_LEAF_SIZE;
+}
+
+void lgc_heap_init(lgc_heap* h) {
+  memset(h, 0, sizeof(lgc_heap));
+  h->head.gc_prev = &h->head;
+  h->head.gc_next = &h->head;
+  h->threshold = LGC_MIN_THRESHOLD;
+}
+
+/* Move the values and counts of heap 'from' into h, leaving it empty */
+void lgc_heap_merge(lgc_heap* h, lgc_heap* from) {
+  if (from->head.gc_next != &from->head) {
+    from->head.gc_next->gc_prev = h->head.gc_prev;
+    from->head.gc_prev->gc_next = &h->head;
+    h->head.gc_prev->gc_next = from->head.gc_next;
+    h->head.gc_prev = from->head.gc_prev;
+  }
+  h->tracked += from->tracked;
+  h->allocs += from->allocs;
+  h->allocated += from->allocated;
+  h->live += from->live;
+  h->bytes += from->bytes;
+  if (h->live > h->peak) { h->peak = h->live; }
+  lgc_heap_init(from);
+}
+
+lval* lgc_alloc(int type) {
+  lgc_heap* h = lgc_cur;
+  lval* v = lpool_alloc(lgc_size(type));
+  v->type = type;
+  v->refs = 1;
+
+  h->allocated++;
+  lstats_alloc(type);
+  h->bytes += lgc_size(type);
+  if (++h->live > h->peak) { h->peak = h->live; }
+
+  if (lgc_is_tracked(v)) {
+    v->gc_next = &h->head;
+    v->gc_prev = h->head.gc_prev;
+    h->head.gc_prev->gc_next = v;
+    h->head.gc_prev = v;
+    h->tracked++;
+    h->allocs++;
+  }
+  return v;
+}
+
+void lgc_free(lval* v) {
+  lgc_heap* h = lgc_cur;
+  if (lgc_is_tracked(v)) {
+    v->gc_prev->gc_next = v->gc_next;
+    v->gc_next->gc_prev = v->gc_prev;
+    h->tracked--;
+  }
+  h->live--;
+  lstats_free(v->type);
+  h->bytes -= lgc_size(v->type);
+  lpool_free(v, lgc_size(v->type));
+}
+
+/* Called at points where every reference held inside a value is counted.
+ * Workers share values with other threads, so the thread they work for
+ * collects once they are done. */
+void lgc_poll(void) {
+  if (lgc_cur->allocs >= lgc_cur->threshold && !lpar_active) {
+    lgc_collect();
+  }
+}
+
+typedef void(*lgc_visit)(lval* child, void* ctx);
+
+static void lgc_children(lval* v, lgc_visit visit, void* ctx) {
+  switch (v->type) {
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      /* The cells of a slice are held by its base */
+      if (v->base) { visit(v->base, ctx); break; }
+      for (int i = 0; i < v->count; i++) {
+        /* Cells being evaluated are detached from their list */
+        if (v->cell[i]) { visit(v->cell[i], ctx); }
+      }
+      break;
+    case LVAL_FUN:
+      if (!v->builtin) {
+        visit(v->formals, ctx);
+        visit(v->body, ctx);
+        for (int i = 0; i < v->env->count; i++) {
+          visit(v->env->vals[i], ctx);
+        }
+      }
+      /* Remembered results may refer back to the function */
+      if (v->memo) {
+        for (lmemo_entry* x = v->memo->head; x; x = x->next) {
+          visit(x->args, ctx);
+          visit(x->result, ctx);
+        }
+      }
+      break;
+    case LVAL_VEC:
+      if (v->store) { visit(v->store, ctx); }
+      break;
+    case LVAL_MAP:
+      if (v->root) { visit(v->root, ctx); }
+      break;
+    case LVAL_MAPNODE:
+      for (int i = 0; i < 2 * v->nslots; i++) {
+        if (v->slots[i]) { visit(v->slots[i], ctx); }
+      }
+      break;
+  }
+}
+
+static void lgc_unref(lval* child, void* ctx) {
+  if (lgc_in_heap(child)) { child->gc_refs--; }
+}
+
+/* Stack of reachable values whose children are still to be marked */
+typedef struct {
+  lval** items;
+  long count;
+  long cap;
+} lgc_stack;
+
+static void lgc_push(lgc_stack* s, lval* v) {
+  if (s->count == s->cap) {
+    s->cap = s->cap ? s->cap * 2 : 256;
+    s->items = realloc(s->items, sizeof(lval*) * s->cap);
+  }
+  s->items[s->count++] = v;
+}
+
+static void lgc_mark(lval* child, void* ctx) {
+  if (lgc_in_heap(child) && child->gc_refs != LGC_REACHABLE) {
+    child->gc_refs = LGC_REACHABLE;
+    lgc_push(ctx, child);
+  }
+}
+
+/* Drop every reference v holds, leaving it empty */
+static void lgc_clear(lval* v) {
+  switch (v->type) {
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (v->base) {
+        lval_del(v->base);
+        v->base = NULL;
+      } else {
+        for (int i = 0; i < v->count; i++) {
+          if (v->cell[i]) { lval_del(v->cell[i]); }
+        }
+        lpool_free(v->cell, sizeof(lval*) * v->cap);
+      }
+      v->count = 0;
+      v->cap = 0;
+      v->cell = NULL;
+      break;
+    case LVAL_FUN:
+      if (!v->builtin) {
+        lval_del(v->formals);
+        lval_del(v->body);
+        lenv_del(v->env);
+        if (v->code) { lcode_del(v->code); }
+      }
+      if (v->memo) {
+        lmemo_del(v->memo);
+        v->memo = NULL;
+      }
+      break;
+    case LVAL_VEC:
+      lval_del(v->store);
+      v->store = NULL;
+      break;
+    case LVAL_MAP:
+      if (v->root) { lval_del(v->root); }
+      v->root = NULL;
+      break;
+    case LVAL_MAPNODE:
+      for (int i = 0; i < 2 * v->nslots; i++) {
+        if (v->slots[i]) { lval_del(v->slots[i]); }
+      }
+      if (v->slots) { lpool_free(v->slots, sizeof(lval*) * 2 * v->nslots); }
+      v->nslots = 0;
+      v->slots = NULL;
+      break;
+  }
+}
+
+static double lgc_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void lgc_collect(void) {
+  lgc_heap* h = lgc_cur;
+  double start = lgc_now();
+
+  /* References not coming from other tracked values are held by the
+   * global environment, the evaluator or the REPL, so they are roots */
+  for (lval* v = h->head.gc_next; v != &h->head; v = v->gc_next) {
+    v->gc_refs = v->refs;
+  }
+  for (lval* v = h->head.gc_next; v != &h->head; v = v->gc_next) {
+    lgc_children(v, lgc_unref, NULL);
+  }
+
+  /* Mark everything reachable from the roots */
+  lgc_stack stack = { NULL, 0, 0 };
+  for (lval* v = h->head.gc_next; v != &h->head; v = v->gc_next) {
+    if (v->gc_refs > 0) {
+      v->gc_refs = LGC_REACHABLE;
+      lgc_push(&stack, v);
+    }
+    while (stack.count) {
+      lgc_children(stack.items[--stack.count], lgc_mark, &stack);
+    }
+  }
+
+  /* Sweep the rest. Hold each one while references between them are
+   * dropped so none is freed before all are cleared. */
+  for (lval* v = h->head.gc_next; v != &h->head; v = v->gc_next) {
+    if (v->gc_refs != LGC_REACHABLE) {
+      v->refs++;
+      lgc_push(&stack, v);
+    }
+  }
+  for (long i = 0; i < stack.count; i++) { lgc_clear(stack.items[i]); }
+  for (long i = 0; i < stack.count; i++) { lgc_free(stack.items[i]); }
+
+  h->freed += stack.count;
+  free(stack.items);
+
+  h->allocs = 0;
+  h->threshold = h->tracked > LGC_MIN_THRESHOLD
+    ? h->tracked : LGC_MIN_THRESHOLD;
+
+  double pause = lgc_now() - start;
+  h->pause_total += pause;
+  if (pause > h->pause_max) { h->pause_max = pause; }
+  h->collections++;
+}
+
+void lgc_print_stats(FILE* f) {
+  lgc_heap* h = lgc_cur;
+  fprintf(f, "gc: %li collections, %li values freed by collector\n",
+    h->collections, h->freed);
+  fprintf(f, "gc: pause total %.3f ms, max %.3f ms, mean %.3f ms\n",
+    h->pause_total, h->pause_max,
+    h->collections ? h->pause_total / h->collections : 0.0);
+  fprintf(f, "gc: live heap %li values (%li bytes), peak %li values\n",
+    h->live, h->bytes, h->peak);
+}
@@ -0,0 +1,50 @@
+#ifndef LGC_H
+#define LGC_H
+
+#include <stdio.h>
+#include "lval.h"
+#include "lpar.h"
+
+/* Managed lval heap.
+ *
+ * Values are reclaimed by reference counting as soon as they are
+ * dropped. Lists and functions are also tracked by a mark and sweep
+ * collector which reclaims groups of values that only reference each
+ * other, which reference counting alone can never free. */
+
+/* Print collector statistics at exit */
+extern int lgc_stats;
+
+/* Tracked values and statistics of a heap */
+typedef struct lgc_heap {
+  /* Sentinel of the circular list of tracked values */
+  lval head;
+  long tracked;
+  long allocs;
+  long threshold;
+
+  long allocated;
+  long live;
+  long bytes;
+  long peak;
+  long collections;
+  long freed;
+  double pause_total;
+  double pause_max;
+} lgc_heap;
+
+/* Heap this thread allocates into */
+extern LTHREAD lgc_heap* lgc_cur;
+
+void lgc_heap_init(lgc_heap* h);
+void lgc_heap_merge(lgc_heap* h, lgc_heap* from);
+
+lval* lgc_alloc(int type);
+size_t lgc_size(int type);
+void lgc_free(lval* v);
+
+void lgc_poll(void);
+void lgc_collect(void);
+void lgc_print_stats(FILE* f);
+
+#endif
@@ -0,0 +1,611 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "limg.h"
+#include "lsym.h"
+#include "lgc.h"
+#include "lvm.h"
+#include "lmemo.h"
+#include "lstr.h"
+#include "lprof.h"
+#include "builtin.h"
+
+#define LIMG_MAGIC "LISPYIMG"
+#define LIMG_VERSION 1
+
+/* Everything in an image is aligned to this many bytes */
+#define LIMG_ALIGN 16
+
+/* Changes made to each field listed in an image once it is relocated */
+enum {
+  LIMG_SYM,     /* replace the name with its interned copy */
+  LIMG_BUILTIN, /* replace the name with the builtin it names */
+  LIMG_MEMO,    /* give the function an empty memo table of 'arg' */
+  LIMG_LAMBDA   /* compile the body of the lambda at 'at' */
+};
+
+typedef struct {
+  uint32_t kind;
+  uint32_t arg;
+  uint64_t at;
+} limg_fixup;
+
+/* Start of each image. Sizes of the structures laid out in it reject
+ * images written by an incompatible build. */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t lval_size;
+  uint32_t lenv_size;
+  uint32_t lstr_size;
+  uint64_t size;
+  uint64_t relocs;
+  uint64_t nrelocs;
+  uint64_t fixups;
+  uint64_t nfixups;
+
+  /* Pairs of a name and the value bound to it */
+  uint64_t globals;
+  uint64_t nglobals;
+} limg_header;
+
+/* Restored images, which stay mapped until the process ends */
+typedef struct limg_mapped {
+  char* base;
+  long size;
+
+  /* Code and memo tables made on restore, which only the image holds */
+  void** made;
+  long nmade;
+
+  struct limg_mapped* next;
+} limg_mapped;
+
+static limg_mapped* limg_images = NULL;
+
+int limg_contains(void* p) {
+  for (limg_mapped* m = limg_images; m; m = m->next) {
+    if ((char*)p >= m->base && (char*)p < m->base + m->size) { return 1; }
+  }
+  return 0;
+}
+
+/* Growing an array of n items of 'size' bytes to hold one more */
+static void* limg_grow(void* p, long n, long* cap, size_t size) {
+  if (n < *cap) { return p; }
+  *cap = *cap ? *cap * 2 : 64;
+  return realloc(p, size * *cap);
+}
+
+/* Value waiting to be written at 'at' */
+typedef struct {
+  lval* v;
+  long at;
+} limg_pending;
+
+typedef struct {
+  char* buf;
+  long len;
+  long cap;
+
+  /* Offsets of fields holding pointers */
+  uint64_t* relocs;
+  long nrelocs;
+  long crelocs;
+
+  limg_fixup* fixups;
+  long nfixups;
+  long cfixups;
+
+  /* Offset each value, buffer and name was written at, by address */
+  void** keys;
+  long* offs;
+  long nkeys;
+  long ckeys;
+
+  limg_pending* queue;
+  long nqueue;
+  long cqueue;
+
+  /* Builtins by function, to save them by name */
+  lenv* builtins;
+} limg_writer;
+
+/* Space for n zeroed bytes, returning their offset */
+static long limg_alloc(limg_writer* w, long n) {
+  long at = w->len;
+  long len = at + (n + LIMG_ALIGN - 1) / LIMG_ALIGN * LIMG_ALIGN;
+  if (len > w->cap) {
+    while (len > w->cap) { w->cap = w->cap ? w->cap * 2 : 4096; }
+    w->buf = realloc(w->buf, w->cap);
+  }
+  memset(w->buf + at, 0, len - at);
+  w->len = len;
+  return at;
+}
+
+static void limg_word(limg_writer* w, long at, uintptr_t x) {
+  memcpy(w->buf + at, &x, sizeof(uintptr_t));
+}
+
+/* List the field at 'at' for relocation if it holds an offset. Numbers
+ * stored in the pointer keep their low bit set and are left alone. */
+static void limg_reloc(limg_writer* w, long at) {
+  uintptr_t x;
+  memcpy(&x, w->buf + at, sizeof(uintptr_t));
+  if (x == 0 || (x & 1)) { return; }
+  w->relocs = limg_grow(w->relocs, w->nrelocs, &w->crelocs, sizeof(uint64_t));
+  w->relocs[w->nrelocs++] = at;
+}
+
+static void limg_fix(limg_writer* w, int kind, long at, int arg) {
+  w->fixups = limg_grow(w->fixups, w->nfixups, &w->cfixups,
+    sizeof(limg_fixup));
+  limg_fixup f = { kind, arg, at };
+  w->fixups[w->nfixups++] = f;
+}
+
+/* Offset p was written at, or 0 with 'slot' set to where it goes */
+static long limg_find(limg_writer* w, void* p, long* slot) {
+  unsigned long mask = w->ckeys - 1;
+  unsigned long i = ((uintptr_t)p >> 3) * 0x9E3779B97F4A7C15ULL >> 16;
+  for (i &= mask; w->keys[i]; i = (i + 1) & mask) {
+    if (w->keys[i] == p) { return w->offs[i]; }
+  }
+  *slot = i;
+  return 0;
+}
+
+static void limg_remember(limg_writer* w, void* p, long at) {
+  long slot = 0;
+  if ((w->nkeys + 1) * 2 > w->ckeys) {
+    void** keys = w->keys;
+    long* offs = w->offs;
+    long cap = w->ckeys;
+    w->ckeys = cap ? cap * 2 : 256;
+    w->keys = calloc(w->ckeys, sizeof(void*));
+    w->offs = malloc(sizeof(long) * w->ckeys);
+    for (long i = 0; i < cap; i++) {
+      if (!keys[i]) { continue; }
+      limg_find(w, keys[i], &slot);
+      w->keys[slot] = keys[i];
+      w->offs[slot] = offs[i];
+    }
+    free(keys);
+    free(offs);
+  }
+  limg_find(w, p, &slot);
+  w->keys[slot] = p;
+  w->offs[slot] = at;
+  w->nkeys++;
+}
+
+static long limg_lookup(limg_writer* w, void* p) {
+  long slot;
+  return w->ckeys ? limg_find(w, p, &slot) : 0;
+}
+
+/* Copy of the n bytes at s followed by a NUL */
+static long limg_bytes(limg_writer* w, char* s, long n) {
+  long at = limg_alloc(w, n + 1);
+  memcpy(w->buf + at, s, n);
+  return at;
+}
+
+/* Interned name, written once however often it is used */
+static long limg_name(limg_writer* w, char* s) {
+  long at = limg_lookup(w, s);
+  if (!at) {
+    at = limg_bytes(w, s, strlen(s));
+    limg_remember(w, s, at);
+  }
+  return at;
+}
+
+/* Store name s at the field 'at' to be interned on restore */
+static void limg_sym(limg_writer* w, long at, char* s) {
+  limg_word(w, at, limg_name(w, s));
+  limg_reloc(w, at);
+  limg_fix(w, LIMG_SYM, at, 0);
+}
+
+/* Word referring to v in the image, placing v there if it is not yet.
+ * Placed values are written once the value being written is done, so
+ * deep and cyclic values are written without recursion. */
+static uintptr_t limg_val(limg_writer* w, lval* v) {
+  if (!v || lval_is_fixnum(v)) { return (uintptr_t)v; }
+  long at = limg_lookup(w, v);
+  if (at) { return at; }
+
+  at = limg_alloc(w, lgc_size(v->type));
+  limg_remember(w, v, at);
+  w->queue = limg_grow(w->queue, w->nqueue, &w->cqueue, sizeof(limg_pending));
+  limg_pending p = { v, at };
+  w->queue[w->nqueue++] = p;
+  return at;
+}
+
+/* Array of n values */
+static long limg_cells(limg_writer* w, lval** cells, long n) {
+  if (n == 0) { return 0; }
+  long at = limg_alloc(w, sizeof(lval*) * n);
+  for (long i = 0; i < n; i++) {
+    limg_word(w, at + sizeof(lval*) * i, limg_val(w, cells[i]));
+    limg_reloc(w, at + sizeof(lval*) * i);
+  }
+  return at;
+}
+
+/* String buffer, shared by every string viewing it */
+static long limg_buffer(limg_writer* w, struct lstr* b) {
+  long at = limg_lookup(w, b);
+  if (at) { return at; }
+
+  at = limg_alloc(w, sizeof(struct lstr));
+  limg_remember(w, b, at);
+  long data = limg_bytes(w, b->data, b->used);
+
+  struct lstr x = { LIMG_REFS, b->used, b->used, (char*)data };
+  memcpy(w->buf + at, &x, sizeof(struct lstr));
+  limg_reloc(w, at + offsetof(struct lstr, data));
+  return at;
+}
+
+/* Environment of a lambda, holding any arguments already given */
+static long limg_env(limg_writer* w, lenv* e) {
+  long at = limg_alloc(w, sizeof(lenv));
+  long syms;
+  long vals;
+  if (e->count <= LENV_INLINE) {
+    syms = at + offsetof(lenv, inline_syms);
+    vals = at + offsetof(lenv, inline_vals);
+  } else {
+    syms = limg_alloc(w, sizeof(char*) * e->count);
+    vals = limg_alloc(w, sizeof(lval*) * e->count);
+  }
+  for (int i = 0; i < e->count; i++) {
+    limg_sym(w, syms + sizeof(char*) * i, e->syms[i]);
+    limg_word(w, vals + sizeof(lval*) * i, limg_val(w, e->vals[i]));
+    limg_reloc(w, vals + sizeof(lval*) * i);
+  }
+
+  lenv x;
+  memcpy(&x, w->buf + at, sizeof(lenv));
+  x.par = NULL;
+  x.count = e->count;
+  x.cap = e->count > LENV_INLINE ? e->count : LENV_INLINE;
+  x.syms = (char**)syms;
+  x.vals = (lval**)vals;
+
+  /* The index hashes the addresses of names, which change on restore,
+   * so the frame is searched in order until a copy indexes itself */
+  x.index = NULL;
+  x.index_cap = 0;
+  memcpy(w->buf + at, &x, sizeof(lenv));
+  limg_reloc(w, at + offsetof(lenv, syms));
+  limg_reloc(w, at + offsetof(lenv, vals));
+  return at;
+}
+
+/* Name the builtin 'f' was added as */
+static char* limg_builtin_name(limg_writer* w, lbuiltin f) {
+  for (int i = 0; i < w->builtins->count; i++) {
+    lval* v = w->builtins->vals[i];
+    if (lval_type(v) == LVAL_FUN && v->builtin == f) {
+      return w->builtins->syms[i];
+    }
+  }
+  return NULL;
+}
+
+#define LIMG_FIELD(f) (at + offsetof(lval, f))
+
+/* Write v, placed at 'at', returning an error if it cannot be saved */
+static lval* limg_write(limg_writer* w, lval* v, long at) {
+  lval x;
+  memset(&x, 0, sizeof(lval));
+  x.type = v->type;
+  x.refs = LIMG_REFS;
+
+  switch (v->type) {
+    case LVAL_NUM: x.num = v->num; break;
+    case LVAL_ERR:
+      x.err = (char*)limg_bytes(w, v->err, strlen(v->err));
+      break;
+
+    /* The name is interned on restore, so is set with the fixups */
+    case LVAL_SYM:
+      x.depth = v->depth;
+      x.slot = v->slot;
+      break;
+
+    case LVAL_STR:
+      x.sbuf = (struct lstr*)limg_buffer(w, v->sbuf);
+      x.soff = v->soff;
+      x.slen = v->slen;
+      break;
+
+    case LVAL_FUN:
+      if (v->builtin) {
+        char* name = limg_builtin_name(w, v->builtin);
+        if (!name) { return lval_err("Cannot save an unnamed builtin"); }
+        x.builtin = (lbuiltin)(uintptr_t)limg_name(w, name);
+      } else {
+        x.env = (lenv*)limg_env(w, v->env);
+        x.formals = (lval*)limg_val(w, v->formals);
+        x.body = (lval*)limg_val(w, v->body);
+      }
+      break;
+
+    /* A slice is written with cells of its own */
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      x.count = v->count;
+      x.cap = v->count;
+      x.cell = (lval**)limg_cells(w, v->cell, v->count);
+      break;
+
+    case LVAL_VEC:
+      x.store = (lval*)limg_val(w, v->store);
+      x.start = v->start;
+      x.len = v->len;
+      break;
+
+    case LVAL_MAP:
+      x.root = (lval*)limg_val(w, v->root);
+      x.nkeys = v->nkeys;
+      break;
+
+    case LVAL_MAPNODE:
+      x.bitmap = v->bitmap;
+      x.nslots = v->nslots;
+      x.slots = (lval**)limg_cells(w, v->slots, 2 * v->nslots);
+      break;
+  }
+  memcpy(w->buf + at, &x, lgc_size(v->type));
+
+  switch (v->type) {
+    case LVAL_ERR: limg_reloc(w, LIMG_FIELD(err)); break;
+    case LVAL_SYM: limg_sym(w, LIMG_FIELD(sym), v->sym); break;
+    case LVAL_STR: limg_reloc(w, LIMG_FIELD(sbuf)); break;
+    case LVAL_FUN:
+      if (v->builtin) {
+        limg_reloc(w, LIMG_FIELD(builtin));
+        limg_fix(w, LIMG_BUILTIN, LIMG_FIELD(builtin), 0);
+      } else {
+        limg_reloc(w, LIMG_FIELD(env));
+        limg_reloc(w, LIMG_FIELD(formals));
+        limg_reloc(w, LIMG_FIELD(body));
+        limg_fix(w, LIMG_LAMBDA, at, 0);
+      }
+      if (v->memo) { limg_fix(w, LIMG_MEMO, at, v->memo->cap); }
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR: limg_reloc(w, LIMG_FIELD(cell)); break;
+    case LVAL_VEC: limg_reloc(w, LIMG_FIELD(store)); break;
+    case LVAL_MAP: limg_reloc(w, LIMG_FIELD(root)); break;
+    case LVAL_MAPNODE: limg_reloc(w, LIMG_FIELD(slots)); break;
+  }
+  return NULL;
+}
+
+lval* limg_save(lenv* e, char* path) {
+  limg_writer w;
+  memset(&w, 0, sizeof(limg_writer));
+  w.builtins = lenv_new();
+  lenv_add_builtins(w.builtins);
+
+  limg_alloc(&w, sizeof(limg_header));
+
+  /* Bindings of the outermost frame */
+  while (e->par) { e = e->par; }
+  long globals = limg_alloc(&w, sizeof(uintptr_t) * 2 * e->count);
+  for (int i = 0; i < e->count; i++) {
+    long at = globals + sizeof(uintptr_t) * 2 * i;
+    limg_sym(&w, at, e->syms[i]);
+    limg_word(&w, at + sizeof(uintptr_t), limg_val(&w, e->vals[i]));
+    limg_reloc(&w, at + sizeof(uintptr_t));
+  }
+
+  lval* err = NULL;
+  for (long i = 0; i < w.nqueue && !err; i++) {
+    err = limg_write(&w, w.queue[i].v, w.queue[i].at);
+  }
+
+  /* Tables follow the values */
+  long relocs = limg_alloc(&w, sizeof(uint64_t) * w.nrelocs);
+  memcpy(w.buf + relocs, w.relocs, sizeof(uint64_t) * w.nrelocs);
+  long fixups = limg_alloc(&w, sizeof(limg_fixup) * w.nfixups);
+  memcpy(w.buf + fixups, w.fixups, sizeof(limg_fixup) * w.nfixups);
+
+  limg_header h;
+  memset(&h, 0, sizeof(limg_header));
+  memcpy(h.magic, LIMG_MAGIC, 8);
+  h.version = LIMG_VERSION;
+  h.lval_size = sizeof(lval);
+  h.lenv_size = sizeof(lenv);
+  h.lstr_size = sizeof(struct lstr);
+  h.size = w.len;
+  h.relocs = relocs;
+  h.nrelocs = w.nrelocs;
+  h.fixups = fixups;
+  h.nfixups = w.nfixups;
+  h.globals = globals;
+  h.nglobals = e->count;
+  memcpy(w.buf, &h, sizeof(limg_header));
+
+  FILE* f = err ? NULL : fopen(path, "wb");
+  if (!err && !f) { err = lval_err("Could not write Image %s", path); }
+  if (f) {
+    if (fwrite(w.buf, 1, w.len, f) != (size_t)w.len) {
+      err = lval_err("Could not write Image %s", path);
+    }
+    if (fclose(f) != 0 && !err) {
+      err = lval_err("Could not write Image %s", path);
+    }
+  }
+
+  lenv_del(w.builtins);
+  free(w.buf);
+  free(w.relocs);
+  free(w.fixups);
+  free(w.keys);
+  free(w.offs);
+  free(w.queue);
+  return err ? err : lval_sexpr();
+}
+
+/* Contents of the file at path, mapped privately where possible so
+ * pages are shared with the file until written */
+static char* limg_open(char* path, long* size) {
+#ifndef _WIN32
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) { return NULL; }
+  struct stat st;
+  char* base = NULL;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) { base = NULL; }
+    *size = st.st_size;
+  }
+  close(fd);
+  return base;
+#else
+  FILE* f = fopen(path, "rb");
+  if (!f) { return NULL; }
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char* base = malloc(*size);
+  if (fread(base, 1, *size, f) != (size_t)*size) {
+    free(base);
+    base = NULL;
+  }
+  fclose(f);
+  return base;
+#endif
+}
+
+static void limg_close(char* base, long size) {
+#ifndef _WIN32
+  munmap(base, size);
+#else
+  free(base);
+#endif
+}
+
+/* Whether the header fits the image and this build */
+static int limg_valid(limg_header* h, long size) {
+  return memcmp(h->magic, LIMG_MAGIC, 8) == 0
+    && h->version == LIMG_VERSION
+    && h->lval_size == sizeof(lval)
+    && h->lenv_size == sizeof(lenv)
+    && h->lstr_size == sizeof(struct lstr)
+    && h->size == (uint64_t)size
+    && h->relocs + sizeof(uint64_t) * h->nrelocs <= h->size
+    && h->fixups + sizeof(limg_fixup) * h->nfixups <= h->size
+    && h->globals + sizeof(uintptr_t) * 2 * h->nglobals <= h->size;
+}
+
+lval* limg_load(lenv* e, char* path) {
+  long size = 0;
+  char* base = limg_open(path, &size);
+  if (!base) { return lval_err("Could not load Image %s", path); }
+
+  limg_header* h = (limg_header*)base;
+  if (size < (long)sizeof(limg_header) || !limg_valid(h, size)) {
+    limg_close(base, size);
+    return lval_err("Image %s was not written by this build", path);
+  }
+
+  /* Relocate before anything is read through a pointer */
+  uint64_t* relocs = (uint64_t*)(base + h->relocs);
+  for (uint64_t i = 0; i < h->nrelocs; i++) {
+    if (relocs[i] + sizeof(uintptr_t) > h->size) {
+      limg_close(base, size);
+      return lval_err("Image %s is damaged", path);
+    }
+    *(uintptr_t*)(base + relocs[i]) += (uintptr_t)base;
+  }
+
+  /* Names are resolved first, so lambdas are compiled once every name
+   * they use is interned, and nothing is allocated for an image which
+   * turns out to name an unknown builtin */
+  lenv* builtins = lenv_new();
+  lenv_add_builtins(builtins);
+  limg_mapped* m = calloc(1, sizeof(limg_mapped));
+  m->made = malloc(sizeof(void*) * (h->nfixups + 1));
+  limg_fixup* fixups = (limg_fixup*)(base + h->fixups);
+  lval* err = NULL;
+  for (int pass = 0; pass < 2 && !err; pass++) {
+    for (uint64_t i = 0; i < h->nfixups; i++) {
+      limg_fixup* f = &fixups[i];
+      void* field = base + f->at;
+      int late = f->kind == LIMG_MEMO || f->kind == LIMG_LAMBDA;
+      if (late != pass) { continue; }
+      if (f->at + (late ? sizeof(lval) : sizeof(uintptr_t)) > h->size) {
+        continue;
+      }
+
+      switch (f->kind) {
+        case LIMG_SYM:
+          *(char**)field = lsym_intern(*(char**)field);
+          break;
+        case LIMG_BUILTIN: {
+          lval* k = lval_sym(*(char**)field);
+          lval* b = lenv_get(builtins, k);
+          if (lval_type(b) == LVAL_FUN && b->builtin) {
+            *(lbuiltin*)field = b->builtin;
+          } else if (!err) {
+            err = lval_err("Image %s uses unknown builtin '%s'", path, k->sym);
+          }
+          lval_del(b);
+          lval_del(k);
+          break;
+        }
+        case LIMG_MEMO:
+          ((lval*)field)->memo = lmemo_new(f->arg);
+          m->made[m->nmade++] = ((lval*)field)->memo;
+          break;
+        case LIMG_LAMBDA:
+          ((lval*)field)->code = lvm_enabled
+            ? lvm_compile(((lval*)field)->body) : NULL;
+          m->made[m->nmade++] = ((lval*)field)->code;
+          break;
+      }
+    }
+  }
+  lenv_del(builtins);
+  if (err) {
+    free(m->made);
+    free(m);
+    limg_close(base, size);
+    return err;
+  }
+
+  uintptr_t* globals = (uintptr_t*)(base + h->globals);
+  for (uint64_t i = 0; i < h->nglobals; i++) {
+    lval* k = lval_sym((char*)globals[2 * i]);
+    lval* v = (lval*)globals[2 * i + 1];
+    if (lprof_enabled && lval_type(v) == LVAL_FUN) { lprof_name(v, k->sym); }
+    lenv_def(e, k, v);
+    lval_del(k);
+  }
+
+  m->base = base;
+  m->size = size;
+  m->next = limg_images;
+  limg_images = m;
+  return lval_sexpr();
+}
@@ -0,0 +1,34 @@
+#ifndef LIMG_H
+#define LIMG_H
+
+#include "lval.h"
+#include "lenv.h"
+
+/* Heap images.
+ *
+ * An image holds the bindings of a global environment and every value
+ * reachable from them, laid out as they are in memory. Pointers are
+ * stored as offsets from the start of the file and listed in a table, so
+ * an image is mapped at any address and restored by adding the address
+ * to each, without reading or evaluating anything. Symbol names are
+ * interned again and builtins looked up by name as they are restored,
+ * and lambda bodies are compiled again as bytecode is not saved.
+ *
+ * Restored values start with LIMG_REFS references, so they are never
+ * freed, and are copied before any change. Memo tables start empty. */
+
+/* Reference count of restored values */
+#define LIMG_REFS (1 << 30)
+
+/* Write the bindings of e to the file at path, returning an error or
+ * an empty S-Expression */
+lval* limg_save(lenv* e, char* path);
+
+/* Bind the names of the image at path in e, returning an error or an
+ * empty S-Expression */
+lval* limg_load(lenv* e, char* path);
+
+/* Whether p points into a restored image */
+int limg_contains(void* p);
+
+#endif
@@ -1,12 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "lenv.h"
 #include "lval.h"
+#include "lgc.h"
+#include "lvm.h"
+#include "lprof.h"
+#include "lstats.h"
+#include "lpar.h"
+#include "limg.h"
 #include "builtin.h"
 
 /* If we are compiling on Windows compile these functions */
 #ifdef _WIN32
-#include <string.h>
 
 static char buffer[2048];
 
@@ -28,45 +34,52 @@ void add_history(char* unused) {}
 #include <readline/readline.h>
 #endif
 
-
-void lenv_add_builtins(lenv* e) {
-  /* List Functions */
-  lenv_add_builtin(e, "list", builtin_list);
-  lenv_add_builtin(e, "head", builtin_head);
-  lenv_add_builtin(e, "tail", builtin_tail);
-  lenv_add_builtin(e, "eval", builtin_eval);
-  lenv_add_builtin(e, "join", builtin_join);
-
-  lenv_add_builtin(e, "def",  builtin_def);
-  lenv_add_builtin(e, "\\", builtin_lambda);
-  lenv_add_builtin(e, "=",   builtin_put);
-
-  /* Mathematical Functions */
-  lenv_add_builtin(e, "+", builtin_add);
-  lenv_add_builtin(e, "-", builtin_sub);
-  lenv_add_builtin(e, "*", builtin_mul);
-  lenv_add_builtin(e, "/", builtin_div);
-
-  /* Comparison Functions */
-  lenv_add_builtin(e, "if", builtin_if);
-  lenv_add_builtin(e, "==", builtin_eq);
-  lenv_add_builtin(e, "!=", builtin_ne);
-  lenv_add_builtin(e, ">",  builtin_gt);
-  lenv_add_builtin(e, "<",  builtin_lt);
-  lenv_add_builtin(e, ">=", builtin_ge);
-  lenv_add_builtin(e, "<=", builtin_le);
-
-  lenv_add_builtin(e, "load", builtin_load);
-  lenv_add_builtin(e, "print", builtin_print);
-  lenv_add_builtin(e, "error", builtin_error);
-}
-
 int main(int argc, char** argv) {
 
+  /* Options come before the list of files */
+  int first = 1;
+  char* stacks = NULL;
+  char* image = NULL;
+  char* save = NULL;
+  while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+    if (strcmp(argv[first], "--gc-stats") == 0) {
+      lgc_stats = 1;
+    } else if (strcmp(argv[first], "--stats") == 0) {
+      lstats_report = 1;
+    } else if (strcmp(argv[first], "--tree") == 0) {
+      lvm_enabled = 0;
+    } else if (strcmp(argv[first], "--profile") == 0) {
+      lprof_enabled = 1;
+    } else if (strncmp(argv[first], "--profile=", 10) == 0) {
+      lprof_enabled = 1;
+      stacks = argv[first] + 10;
+    } else if (strncmp(argv[first], "--threads=", 10) == 0) {
+      lpar_threads = atoi(argv[first] + 10);
+    } else if (strcmp(argv[first], "--image") == 0 && first + 1 < argc) {
+      image = argv[++first];
+    } else if (strcmp(argv[first], "--save-image") == 0 && first + 1 < argc) {
+      save = argv[++first];
+    } else {
+      fprintf(stderr, "Unknown option %s\n", argv[first]);
+      return 1;
+    }
+    first++;
+  }
+
   lenv* e = lenv_new();
   lenv_add_builtins(e);
 
-  if (argc == 1) {
+  if (image) {
+    lval* x = limg_load(e, image);
+    if (lval_type(x) == LVAL_ERR) {
+      lval_println(x);
+      return 1;
+    }
+    lval_del(x);
+  }
+
+  /* Making an image loads its files without starting a prompt */
+  if (first == argc && !save) {
 
     puts("Lispy Version 0.0.1");
     puts("Press Ctrl+c to Exit\n");
@@ -75,10 +88,13 @@ int main(int argc, char** argv) {
 
       /* Now in either case readline will be correctly defined */
       char* input = readline("lispy> ");
+
+      /* Stop at end of input */
+      if (!input) { putchar('\n'); break; }
       add_history(input);
 
       lval* expr = lval_sexpr();
-      lval_read_expr(expr, input, 0, '\0');
+      lval_read_expr(expr, input, 0, strlen(input), '\0');
       lval* x = lval_eval(e, expr);
       lval_println(x);
       lval_del(x);
@@ -87,25 +103,45 @@ int main(int argc, char** argv) {
     }
   }
 
-    /* Supplied with list of files */
-  if (argc >= 2) {
+  /* loop over each supplied filename */
+  for (int i = first; i < argc; i++) {
 
-    /* loop over each supplied filename (starting from 1) */
-    for (int i = 1; i < argc; i++) {
+    /* Argument list with a single argument, the filename */
+    lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
 
-      /* Argument list with a single argument, the filename */
-      lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
+    /* Pass to builtin load and get the result */
+    lval* x = builtin_load(e, args);
 
-      /* Pass to builtin load and get the result */
-      lval* x = builtin_load(e, args);
+    /* If the result is an error be sure to print it */
+    if (lval_type(x) == LVAL_ERR) { lval_println(x); }
+    lval_del(x);
+  }
 
-      /* If the result is an error be sure to print it */
-      if (x->type == LVAL_ERR) { lval_println(x); }
-      lval_del(x);
+  int status = 0;
+  if (save) {
+    lval* x = limg_save(e, save);
+    if (lval_type(x) == LVAL_ERR) {
+      lval_println(x);
+      status = 1;
+    }
+    lval_del(x);
+  }
+
+  if (lgc_stats) { lgc_print_stats(stderr); }
+  if (lstats_report) { lstats_print(lstats_cur, stderr); }
+
+  if (lprof_enabled) {
+    lprof_print(stderr);
+    FILE* f = stacks ? fopen(stacks, "w") : NULL;
+    if (f) {
+      lprof_print_stacks(f);
+      fclose(f);
+    } else if (stacks) {
+      fprintf(stderr, "Could not write %s\n", stacks);
     }
   }
 
   lenv_del(e);
 
-  return 0;
+  return status;
 }
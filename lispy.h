@@ -0,0 +1,48 @@
+#ifndef LISPY_H
+#define LISPY_H
+
+#include <stdio.h>
+
+/* Embedding API.
+ *
+ * Each interpreter has its own heap, global environment, symbol table
+ * and counters, so several can run at once on different threads without
+ * sharing locks. One interpreter is used by one thread at a time, which
+ * may change between calls. Values belong to the interpreter that
+ * returned them and are released through it. Link with liblispy.a. */
+
+typedef struct lispy lispy;
+typedef struct lval lispy_val;
+
+/* Types of values */
+enum { LISPY_NUM, LISPY_ERR, LISPY_SYM, LISPY_STR, LISPY_FUN, LISPY_SEXPR,
+  LISPY_QEXPR, LISPY_VEC, LISPY_MAP };
+
+/* New interpreter with the builtins defined */
+lispy* lispy_new(void);
+void lispy_free(lispy* L);
+
+/* Evaluate each expression in turn, returning the value of the last or
+ * the first error. The result is released with lispy_release. */
+lispy_val* lispy_eval_string(lispy* L, const char* src);
+lispy_val* lispy_load(lispy* L, const char* path);
+void lispy_release(lispy* L, lispy_val* v);
+
+int lispy_type(lispy_val* v);
+long lispy_num(lispy_val* v);
+
+/* Characters of a string, which are not NUL terminated */
+const char* lispy_str(lispy_val* v, long* len);
+
+/* Name of a symbol, or message of an error */
+const char* lispy_sym(lispy_val* v);
+const char* lispy_err(lispy_val* v);
+
+/* Items of a list or vector, borrowed from it */
+int lispy_len(lispy_val* v);
+lispy_val* lispy_item(lispy_val* v, int i);
+
+void lispy_print(lispy* L, lispy_val* v, FILE* f);
+void lispy_print_stats(lispy* L, FILE* f);
+
+#endif
@@ -0,0 +1,199 @@
+#include <string.h>
+#include "lmap.h"
+#include "lgc.h"
+#include "lpool.h"
+
+/* Bits of the hash used at each level of the trie */
+#define LMAP_LEVEL 5
+#define LMAP_HASH_BITS ((int)sizeof(unsigned long) * CHAR_BIT)
+
+static int lmap_popcount(uint32_t x) {
+#if defined(__GNUC__)
+  return __builtin_popcount(x);
+#else
+  int n = 0;
+  for (; x; x &= x - 1) { n++; }
+  return n;
+#endif
+}
+
+static lval* lmap_node(int nslots) {
+  lval* n = lgc_alloc(LVAL_MAPNODE);
+  n->bitmap = 0;
+  n->nslots = nslots;
+  n->slots = nslots ? lpool_alloc(sizeof(lval*) * 2 * nslots) : NULL;
+  return n;
+}
+
+/* Resize the slots of node n, opening or closing a gap at 'pos' */
+static void lmap_resize(lval* n, int pos, int nslots) {
+  lval** slots = nslots ? lpool_alloc(sizeof(lval*) * 2 * nslots) : NULL;
+  int before = pos;
+  int after = (nslots > n->nslots ? n->nslots : nslots) - pos;
+  int skip = nslots > n->nslots ? 0 : n->nslots - nslots;
+  int gap = nslots > n->nslots ? nslots - n->nslots : 0;
+  if (before) { memcpy(slots, n->slots, sizeof(lval*) * 2 * before); }
+  if (after) {
+    memcpy(slots + 2 * (pos + gap), n->slots + 2 * (pos + skip),
+      sizeof(lval*) * 2 * after);
+  }
+  if (n->slots) { lpool_free(n->slots, sizeof(lval*) * 2 * n->nslots); }
+  n->slots = slots;
+  n->nslots = nslots;
+}
+
+/* Node n with k bound to v, taking all three references. Sets 'added'
+ * if k was not already present. */
+static lval* lmap_node_put(lval* n, int shift, unsigned long hash,
+  lval* k, lval* v, int* added) {
+
+  /* Keys hashing alike past the last level are searched in order */
+  if (shift >= LMAP_HASH_BITS) {
+    if (!n) { n = lmap_node(0); }
+    n = lval_own(n);
+    for (int i = 0; i < n->nslots; i++) {
+      if (lval_eq(n->slots[2*i], k)) {
+        lval_del(k);
+        lval_del(n->slots[2*i+1]);
+        n->slots[2*i+1] = v;
+        return n;
+      }
+    }
+    lmap_resize(n, n->nslots, n->nslots + 1);
+    n->slots[2*n->nslots-2] = k;
+    n->slots[2*n->nslots-1] = v;
+    *added = 1;
+    return n;
+  }
+
+  if (!n) { n = lmap_node(0); }
+  n = lval_own(n);
+
+  uint32_t bit = (uint32_t)1 << ((hash >> shift) & 31);
+  int pos = lmap_popcount(n->bitmap & (bit - 1));
+
+  /* New entry */
+  if (!(n->bitmap & bit)) {
+    lmap_resize(n, pos, n->nslots + 1);
+    n->bitmap |= bit;
+    n->slots[2*pos] = k;
+    n->slots[2*pos+1] = v;
+    *added = 1;
+    return n;
+  }
+
+  lval** slot = &n->slots[2*pos];
+
+  /* Child node */
+  if (!slot[0]) {
+    slot[1] = lmap_node_put(slot[1], shift + LMAP_LEVEL, hash, k, v, added);
+    return n;
+  }
+
+  /* Same key */
+  if (lval_eq(slot[0], k)) {
+    lval_del(k);
+    lval_del(slot[1]);
+    slot[1] = v;
+    return n;
+  }
+
+  /* Another key sharing these bits moves down with the new one */
+  lval* child = lmap_node_put(NULL, shift + LMAP_LEVEL, lval_hash(slot[0]),
+    slot[0], slot[1], added);
+  slot[0] = NULL;
+  slot[1] = lmap_node_put(child, shift + LMAP_LEVEL, hash, k, v, added);
+  *added = 1;
+  return n;
+}
+
+/* Node n without k, which must be present, or NULL if it is left empty.
+ * Takes the reference to n. */
+static lval* lmap_node_remove(lval* n, int shift, unsigned long hash, lval* k) {
+  n = lval_own(n);
+
+  int pos;
+  if (shift >= LMAP_HASH_BITS) {
+    for (pos = 0; !lval_eq(n->slots[2*pos], k); pos++) {}
+    lval_del(n->slots[2*pos]);
+    lval_del(n->slots[2*pos+1]);
+  } else {
+    uint32_t bit = (uint32_t)1 << ((hash >> shift) & 31);
+    pos = lmap_popcount(n->bitmap & (bit - 1));
+
+    lval** slot = &n->slots[2*pos];
+    if (!slot[0]) {
+      lval* child = lmap_node_remove(slot[1], shift + LMAP_LEVEL, hash, k);
+      slot[1] = child;
+
+      /* A child left holding a single key is replaced by that key */
+      if (child && child->nslots == 1 && child->slots[0]) {
+        slot[0] = lval_copy(child->slots[0]);
+        slot[1] = lval_copy(child->slots[1]);
+        lval_del(child);
+      }
+      if (child) { return n; }
+    } else {
+      lval_del(slot[0]);
+      lval_del(slot[1]);
+    }
+    n->bitmap &= ~bit;
+  }
+
+  /* The slot at 'pos' now holds no references */
+  lmap_resize(n, pos, n->nslots - 1);
+  if (!n->nslots) {
+    lval_del(n);
+    return NULL;
+  }
+  return n;
+}
+
+lval* lmap_get(lval* m, lval* k) {
+  unsigned long hash = lval_hash(k);
+  lval* n = m->root;
+  for (int shift = 0; n; shift += LMAP_LEVEL) {
+    if (shift >= LMAP_HASH_BITS) {
+      for (int i = 0; i < n->nslots; i++) {
+        if (lval_eq(n->slots[2*i], k)) { return n->slots[2*i+1]; }
+      }
+      return NULL;
+    }
+    uint32_t bit = (uint32_t)1 << ((hash >> shift) & 31);
+    if (!(n->bitmap & bit)) { return NULL; }
+    lval** slot = &n->slots[2 * lmap_popcount(n->bitmap & (bit - 1))];
+    if (slot[0]) { return lval_eq(slot[0], k) ? slot[1] : NULL; }
+    n = slot[1];
+  }
+  return NULL;
+}
+
+lval* lmap_put(lval* m, lval* k, lval* v) {
+  m = lval_own(m);
+  int added = 0;
+  m->root = lmap_node_put(m->root, 0, lval_hash(k), k, v, &added);
+  m->nkeys += added;
+  return m;
+}
+
+lval* lmap_remove(lval* m, lval* k) {
+  if (!lmap_get(m, k)) { return m; }
+  m = lval_own(m);
+  m->root = lmap_node_remove(m->root, 0, lval_hash(k), k);
+  m->nkeys--;
+  return m;
+}
+
+static void lmap_node_each(lval* n, lmap_visit f, void* ctx) {
+  for (int i = 0; i < n->nslots; i++) {
+    if (n->slots[2*i]) {
+      f(n->slots[2*i], n->slots[2*i+1], ctx);
+    } else {
+      lmap_node_each(n->slots[2*i+1], f, ctx);
+    }
+  }
+}
+
+void lmap_each(lval* m, lmap_visit f, void* ctx) {
+  if (m->root) { lmap_node_each(m->root, f, ctx); }
+}
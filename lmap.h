@@ -0,0 +1,31 @@
+#ifndef LMAP_H
+#define LMAP_H
+
+#include "lval.h"
+
+/* Hash maps from numbers, strings and symbols to values.
+ *
+ * A map is a hash array mapped trie. Each node has a bit set for each
+ * value of the next five bits of the hash it holds, and two cells for
+ * each: a key and its value, or NULL and a child node. Past the last
+ * bits of the hash, keys which hash alike are kept in a collision node
+ * with no bitmap which is searched in order.
+ *
+ * Updates copy the nodes on the path to the entry they change, except
+ * those not shared which are changed in place, so updating a map that
+ * is still referenced elsewhere costs only a few small copies. */
+
+/* Value bound to k, still held by the map, or NULL */
+lval* lmap_get(lval* m, lval* k);
+
+/* Map m with k bound to v. Takes the references to m, k and v. */
+lval* lmap_put(lval* m, lval* k, lval* v);
+
+/* Map m without k. Takes the reference to m. */
+lval* lmap_remove(lval* m, lval* k);
+
+/* Call f with each key and value of m */
+typedef void(*lmap_visit)(lval* k, lval* v, void* ctx);
+void lmap_each(lval* m, lmap_visit f, void* ctx);
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include "lmemo.h"
+#include "lpool.h"
+
+lmemo* lmemo_new(int cap) {
+  lmemo* m = calloc(1, sizeof(lmemo));
+  m->cap = cap;
+  m->nbuckets = 16;
+  m->buckets = calloc(m->nbuckets, sizeof(lmemo_entry*));
+  return m;
+}
+
+void lmemo_del(lmemo* m) {
+  lmemo_entry* x = m->head;
+  while (x) {
+    lmemo_entry* next = x->next;
+    lval_del(x->args);
+    lval_del(x->result);
+    lpool_free(x, sizeof(lmemo_entry));
+    x = next;
+  }
+  free(m->buckets);
+  free(m);
+}
+
+/* Hash of the cells of an argument list */
+static unsigned long lmemo_hash(lval* args) {
+  unsigned long h = 2166136261UL;
+  for (int i = 0; i < args->count; i++) {
+    h = (h ^ lval_hash(args->cell[i])) * 16777619UL;
+  }
+  return h;
+}
+
+static int lmemo_eq(lval* x, lval* y) {
+  if (x->count != y->count) { return 0; }
+  for (int i = 0; i < x->count; i++) {
+    if (!lval_eq(x->cell[i], y->cell[i])) { return 0; }
+  }
+  return 1;
+}
+
+static lmemo_entry** lmemo_bucket(lmemo* m, unsigned long hash) {
+  return &m->buckets[(hash ^ (hash >> 16)) & (m->nbuckets - 1)];
+}
+
+/* Remove x from the order of use */
+static void lmemo_unlink(lmemo* m, lmemo_entry* x) {
+  if (x->prev) { x->prev->next = x->next; } else { m->head = x->next; }
+  if (x->next) { x->next->prev = x->prev; } else { m->tail = x->prev; }
+}
+
+/* Make x the most recently used entry */
+static void lmemo_push(lmemo* m, lmemo_entry* x) {
+  x->prev = NULL;
+  x->next = m->head;
+  if (m->head) { m->head->prev = x; } else { m->tail = x; }
+  m->head = x;
+}
+
+static lmemo_entry* lmemo_find(lmemo* m, lval* args, unsigned long hash) {
+  for (lmemo_entry* x = *lmemo_bucket(m, hash); x; x = x->chain) {
+    if (x->hash == hash && lmemo_eq(x->args, args)) { return x; }
+  }
+  return NULL;
+}
+
+lval* lmemo_get(lmemo* m, lval* args, unsigned long* hash) {
+  *hash = lmemo_hash(args);
+  lmemo_entry* x = lmemo_find(m, args, *hash);
+  if (!x) {
+    m->misses++;
+    return NULL;
+  }
+  m->hits++;
+  if (x != m->head) {
+    lmemo_unlink(m, x);
+    lmemo_push(m, x);
+  }
+  return lval_copy(x->result);
+}
+
+static void lmemo_grow(lmemo* m) {
+  lmemo_entry** old = m->buckets;
+  int n = m->nbuckets;
+  m->nbuckets *= 2;
+  m->buckets = calloc(m->nbuckets, sizeof(lmemo_entry*));
+  for (int i = 0; i < n; i++) {
+    lmemo_entry* x = old[i];
+    while (x) {
+      lmemo_entry* chain = x->chain;
+      lmemo_entry** b = lmemo_bucket(m, x->hash);
+      x->chain = *b;
+      *b = x;
+      x = chain;
+    }
+  }
+  free(old);
+}
+
+/* Drop the least recently used entry */
+static void lmemo_evict(lmemo* m) {
+  lmemo_entry* x = m->tail;
+  lmemo_entry** b = lmemo_bucket(m, x->hash);
+  while (*b != x) { b = &(*b)->chain; }
+  *b = x->chain;
+  lmemo_unlink(m, x);
+  m->count--;
+  m->evictions++;
+  lval_del(x->args);
+  lval_del(x->result);
+  lpool_free(x, sizeof(lmemo_entry));
+}
+
+void lmemo_put(lmemo* m, lval* args, unsigned long hash, lval* result) {
+  /* An equal call may have finished while this one ran */
+  lmemo_entry* x = lmemo_find(m, args, hash);
+  if (x) {
+    lval_del(args);
+    lval_del(x->result);
+    x->result = result;
+    return;
+  }
+
+  if (m->count == m->cap) { lmemo_evict(m); }
+  if (m->count >= m->nbuckets) { lmemo_grow(m); }
+
+  x = lpool_alloc(sizeof(lmemo_entry));
+  x->hash = hash;
+  x->args = args;
+  x->result = result;
+  lmemo_entry** b = lmemo_bucket(m, hash);
+  x->chain = *b;
+  *b = x;
+  lmemo_push(m, x);
+  m->count++;
+}
@@ -0,0 +1,52 @@
+#ifndef LMEMO_H
+#define LMEMO_H
+
+#include "lval.h"
+
+/* Result cache of a memoized function.
+ *
+ * Argument lists are hashed with lval_hash and compared with lval_eq.
+ * Once 'cap' results are held the least recently used one is evicted. */
+
+/* Capacity of a cache when none is given */
+#define LMEMO_DEFAULT_CAP 1024
+
+typedef struct lmemo_entry lmemo_entry;
+
+struct lmemo_entry {
+  unsigned long hash;
+  lval* args;
+  lval* result;
+
+  /* Next entry in the same bucket */
+  lmemo_entry* chain;
+
+  /* Neighbours in order of use, most recent first */
+  lmemo_entry* prev;
+  lmemo_entry* next;
+};
+
+typedef struct lmemo {
+  int cap;
+  int count;
+  int nbuckets;
+  lmemo_entry** buckets;
+  lmemo_entry* head;
+  lmemo_entry* tail;
+
+  /* Statistics */
+  long hits;
+  long misses;
+  long evictions;
+} lmemo;
+
+lmemo* lmemo_new(int cap);
+void lmemo_del(lmemo* m);
+
+/* Cached result for 'args' or NULL, setting 'hash' for lmemo_put */
+lval* lmemo_get(lmemo* m, lval* args, unsigned long* hash);
+
+/* Remember 'result' for 'args', taking both references */
+void lmemo_put(lmemo* m, lval* args, unsigned long hash, lval* result);
+
+#endif
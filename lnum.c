@@ -0,0 +1,302 @@
+#include "lnum.h"
+
+#if LNUM_SIMD && defined(__GNUC__) && defined(__x86_64__)
+#define LNUM_X86 1
+#include <immintrin.h>
+#else
+#define LNUM_X86 0
+#endif
+
+/* Scalar kernels, for any numbers */
+
+static int lnum_sum_scalar(lval** xs, int n, long* r) {
+  long x = 0;
+  for (int i = 0; i < n; i++) {
+    if (lval_type(xs[i]) != LVAL_NUM) { return LNUM_TYPE; }
+    if (lnum_add(x, lval_as_num(xs[i]), &x)) { return LNUM_OVERFLOW; }
+  }
+  *r = x;
+  return LNUM_OK;
+}
+
+static int lnum_minmax_scalar(lval** xs, int n, long* r, int max) {
+  if (lval_type(xs[0]) != LVAL_NUM) { return LNUM_TYPE; }
+  long x = lval_as_num(xs[0]);
+  for (int i = 1; i < n; i++) {
+    if (lval_type(xs[i]) != LVAL_NUM) { return LNUM_TYPE; }
+    long y = lval_as_num(xs[i]);
+    if (max ? y > x : y < x) { x = y; }
+  }
+  *r = x;
+  return LNUM_OK;
+}
+
+static int lnum_vadd_scalar(lval** xs, lval** ys, lval** out, int n) {
+  for (int i = 0; i < n; i++) {
+    long x;
+    int status = LNUM_OK;
+    if (lval_type(xs[i]) != LVAL_NUM || lval_type(ys[i]) != LVAL_NUM) {
+      status = LNUM_TYPE;
+    } else if (lnum_add(lval_as_num(xs[i]), lval_as_num(ys[i]), &x)) {
+      status = LNUM_OVERFLOW;
+    }
+    if (status != LNUM_OK) {
+      while (i--) { lval_del(out[i]); }
+      return status;
+    }
+    out[i] = lval_num(x);
+  }
+  return LNUM_OK;
+}
+
+#if LNUM_X86
+
+/* Fixnums are held as 2x+1. With the tag bit cleared they are 2x, which
+ * can be added directly and keep their order when compared. A sum of
+ * such values that overflows is left to the scalar kernel, which can
+ * still give a result outside the fixnum range. */
+
+/* Signed overflow of s = x + y shows in the sign bit of this */
+#define LNUM_OVF(x, y, s, xor, and) and(xor(x, s), xor(y, s))
+
+static int lnum_has_avx2(void) {
+  return __builtin_cpu_supports("avx2");
+}
+
+/* Add the halved lanes of a vector sum, which are exact as they are even */
+static int lnum_add_lanes(long* lanes, int count, long* r) {
+  long x = 0;
+  for (int i = 0; i < count; i++) {
+    if (lnum_add(x, lanes[i] >> 1, &x)) { return LNUM_OVERFLOW; }
+  }
+  *r = x;
+  return LNUM_OK;
+}
+
+static int lnum_sum_sse2(lval** xs, int n, long* r) {
+  __m128i one = _mm_set1_epi64x(1);
+  __m128i tags = _mm_set1_epi64x(-1);
+  __m128i ovf = _mm_setzero_si128();
+  __m128i acc = _mm_setzero_si128();
+
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i p = _mm_loadu_si128((__m128i*)(xs + i));
+    __m128i x = _mm_xor_si128(p, one);
+    __m128i s = _mm_add_epi64(acc, x);
+    tags = _mm_and_si128(tags, p);
+    ovf = _mm_or_si128(ovf,
+      LNUM_OVF(acc, x, s, _mm_xor_si128, _mm_and_si128));
+    acc = s;
+  }
+
+  __m128i untagged = _mm_andnot_si128(tags, one);
+  if (_mm_movemask_epi8(_mm_cmpeq_epi32(untagged, _mm_setzero_si128()))
+    != 0xFFFF) { return LNUM_TYPE; }
+  if (_mm_movemask_pd(_mm_castsi128_pd(ovf))) { return LNUM_OVERFLOW; }
+
+  long lanes[3];
+  _mm_storeu_si128((__m128i*)lanes, acc);
+  lanes[2] = 0;
+  if (i < n) {
+    if (!lval_is_fixnum(xs[i])) { return LNUM_TYPE; }
+    lanes[2] = (long)((uintptr_t)xs[i] ^ 1);
+  }
+  return lnum_add_lanes(lanes, 3, r);
+}
+
+__attribute__((target("avx2")))
+static int lnum_sum_avx2(lval** xs, int n, long* r) {
+  __m256i one = _mm256_set1_epi64x(1);
+  __m256i tags = _mm256_set1_epi64x(-1);
+  __m256i ovf = _mm256_setzero_si256();
+  __m256i acc = _mm256_setzero_si256();
+
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i p = _mm256_loadu_si256((__m256i*)(xs + i));
+    __m256i x = _mm256_xor_si256(p, one);
+    __m256i s = _mm256_add_epi64(acc, x);
+    tags = _mm256_and_si256(tags, p);
+    ovf = _mm256_or_si256(ovf,
+      LNUM_OVF(acc, x, s, _mm256_xor_si256, _mm256_and_si256));
+    acc = s;
+  }
+
+  if (!_mm256_testc_si256(tags, one)) { return LNUM_TYPE; }
+  if (_mm256_movemask_pd(_mm256_castsi256_pd(ovf))) { return LNUM_OVERFLOW; }
+
+  long lanes[7] = { 0 };
+  _mm256_storeu_si256((__m256i*)lanes, acc);
+  for (int j = 4; i < n; i++, j++) {
+    if (!lval_is_fixnum(xs[i])) { return LNUM_TYPE; }
+    lanes[j] = (long)((uintptr_t)xs[i] ^ 1);
+  }
+  return lnum_add_lanes(lanes, 7, r);
+}
+
+/* Tagged fixnums compare as their values do */
+__attribute__((target("avx2")))
+static int lnum_minmax_avx2(lval** xs, int n, long* r, int max) {
+  __m256i one = _mm256_set1_epi64x(1);
+  __m256i tags = _mm256_set1_epi64x(-1);
+  __m256i acc = _mm256_set1_epi64x((long long)(uintptr_t)xs[0]);
+
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i p = _mm256_loadu_si256((__m256i*)(xs + i));
+    __m256i take = max
+      ? _mm256_cmpgt_epi64(p, acc) : _mm256_cmpgt_epi64(acc, p);
+    tags = _mm256_and_si256(tags, p);
+    acc = _mm256_blendv_epi8(acc, p, take);
+  }
+
+  if (!_mm256_testc_si256(tags, one)) { return LNUM_TYPE; }
+
+  long lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, acc);
+  long x = lanes[0];
+  for (int j = 1; j < 4; j++) {
+    if (max ? lanes[j] > x : lanes[j] < x) { x = lanes[j]; }
+  }
+  for (; i < n; i++) {
+    if (!lval_is_fixnum(xs[i])) { return LNUM_TYPE; }
+    long y = (long)(uintptr_t)xs[i];
+    if (max ? y > x : y < x) { x = y; }
+  }
+  *r = lval_as_num((lval*)(uintptr_t)x);
+  return LNUM_OK;
+}
+
+/* Sums of 2x and 2y that do not overflow are 2(x+y), a fixnum once
+ * tagged again */
+static int lnum_vadd_sse2(lval** xs, lval** ys, lval** out, int n) {
+  __m128i one = _mm_set1_epi64x(1);
+  __m128i tags = _mm_set1_epi64x(-1);
+  __m128i ovf = _mm_setzero_si128();
+
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i p = _mm_loadu_si128((__m128i*)(xs + i));
+    __m128i q = _mm_loadu_si128((__m128i*)(ys + i));
+    __m128i x = _mm_xor_si128(p, one);
+    __m128i y = _mm_xor_si128(q, one);
+    __m128i s = _mm_add_epi64(x, y);
+    tags = _mm_and_si128(tags, _mm_and_si128(p, q));
+    ovf = _mm_or_si128(ovf, LNUM_OVF(x, y, s, _mm_xor_si128, _mm_and_si128));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(s, one));
+  }
+
+  __m128i untagged = _mm_andnot_si128(tags, one);
+  if (_mm_movemask_epi8(_mm_cmpeq_epi32(untagged, _mm_setzero_si128()))
+    != 0xFFFF) { return LNUM_TYPE; }
+  if (_mm_movemask_pd(_mm_castsi128_pd(ovf))) { return LNUM_OVERFLOW; }
+
+  /* Fixnums hold no references so only the rest need releasing */
+  return lnum_vadd_scalar(xs + i, ys + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int lnum_vadd_avx2(lval** xs, lval** ys, lval** out, int n) {
+  __m256i one = _mm256_set1_epi64x(1);
+  __m256i tags = _mm256_set1_epi64x(-1);
+  __m256i ovf = _mm256_setzero_si256();
+
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i p = _mm256_loadu_si256((__m256i*)(xs + i));
+    __m256i q = _mm256_loadu_si256((__m256i*)(ys + i));
+    __m256i x = _mm256_xor_si256(p, one);
+    __m256i y = _mm256_xor_si256(q, one);
+    __m256i s = _mm256_add_epi64(x, y);
+    tags = _mm256_and_si256(tags, _mm256_and_si256(p, q));
+    ovf = _mm256_or_si256(ovf,
+      LNUM_OVF(x, y, s, _mm256_xor_si256, _mm256_and_si256));
+    _mm256_storeu_si256((__m256i*)(out + i), _mm256_or_si256(s, one));
+  }
+
+  if (!_mm256_testc_si256(tags, one)) { return LNUM_TYPE; }
+  if (_mm256_movemask_pd(_mm256_castsi256_pd(ovf))) { return LNUM_OVERFLOW; }
+
+  return lnum_vadd_scalar(xs + i, ys + i, out + i, n - i);
+}
+
+#endif
+
+int lnum_sum(lval** xs, int n, long* r) {
+#if LNUM_X86
+  int status = lnum_has_avx2()
+    ? lnum_sum_avx2(xs, n, r) : lnum_sum_sse2(xs, n, r);
+  if (status == LNUM_OK) { return status; }
+#endif
+  return lnum_sum_scalar(xs, n, r);
+}
+
+/* There is no 64 bit multiply in SSE2 or AVX2 so products are scalar */
+int lnum_product(lval** xs, int n, long* r) {
+  long x = 1;
+  for (int i = 0; i < n; i++) {
+    if (lval_type(xs[i]) != LVAL_NUM) { return LNUM_TYPE; }
+    if (lnum_mul(x, lval_as_num(xs[i]), &x)) { return LNUM_OVERFLOW; }
+  }
+  *r = x;
+  return LNUM_OK;
+}
+
+int lnum_min(lval** xs, int n, long* r) {
+#if LNUM_X86
+  if (lnum_has_avx2() && lval_is_fixnum(xs[0])
+    && lnum_minmax_avx2(xs, n, r, 0) == LNUM_OK) { return LNUM_OK; }
+#endif
+  return lnum_minmax_scalar(xs, n, r, 0);
+}
+
+int lnum_max(lval** xs, int n, long* r) {
+#if LNUM_X86
+  if (lnum_has_avx2() && lval_is_fixnum(xs[0])
+    && lnum_minmax_avx2(xs, n, r, 1) == LNUM_OK) { return LNUM_OK; }
+#endif
+  return lnum_minmax_scalar(xs, n, r, 1);
+}
+
+int lnum_dot(lval** xs, lval** ys, int n, long* r) {
+  long x = 0;
+  for (int i = 0; i < n; i++) {
+    if (lval_type(xs[i]) != LVAL_NUM || lval_type(ys[i]) != LVAL_NUM) {
+      return LNUM_TYPE;
+    }
+    long y;
+    if (lnum_mul(lval_as_num(xs[i]), lval_as_num(ys[i]), &y)
+      || lnum_add(x, y, &x)) { return LNUM_OVERFLOW; }
+  }
+  *r = x;
+  return LNUM_OK;
+}
+
+int lnum_vadd(lval** xs, lval** ys, lval** out, int n) {
+#if LNUM_X86
+  /* A failed vector pass leaves only fixnums in out, so it is redone */
+  int status = lnum_has_avx2()
+    ? lnum_vadd_avx2(xs, ys, out, n) : lnum_vadd_sse2(xs, ys, out, n);
+  if (status == LNUM_OK) { return status; }
+#endif
+  return lnum_vadd_scalar(xs, ys, out, n);
+}
+
+int lnum_vmul(lval** xs, lval** ys, lval** out, int n) {
+  for (int i = 0; i < n; i++) {
+    long x;
+    int status = LNUM_OK;
+    if (lval_type(xs[i]) != LVAL_NUM || lval_type(ys[i]) != LVAL_NUM) {
+      status = LNUM_TYPE;
+    } else if (lnum_mul(lval_as_num(xs[i]), lval_as_num(ys[i]), &x)) {
+      status = LNUM_OVERFLOW;
+    }
+    if (status != LNUM_OK) {
+      while (i--) { lval_del(out[i]); }
+      return status;
+    }
+    out[i] = lval_num(x);
+  }
+  return LNUM_OK;
+}
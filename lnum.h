@@ -0,0 +1,66 @@
+#ifndef LNUM_H
+#define LNUM_H
+
+#include "lval.h"
+
+/* Numeric kernels over arrays of lval numbers.
+ *
+ * Arrays made only of fixnums are processed with SSE2 or AVX2 where the
+ * processor has them, anything else by a scalar loop that also handles
+ * boxed numbers. Build with -DLNUM_SIMD=0 to always use the scalar loop. */
+#ifndef LNUM_SIMD
+#define LNUM_SIMD 1
+#endif
+
+/* Kernel results */
+enum { LNUM_OK, LNUM_TYPE, LNUM_OVERFLOW };
+
+/* Overflow checked arithmetic, returning nonzero on overflow */
+static inline int lnum_add(long x, long y, long* r) {
+#if defined(__GNUC__)
+  return __builtin_add_overflow(x, y, r);
+#else
+  if ((y > 0 && x > LONG_MAX - y) || (y < 0 && x < LONG_MIN - y)) { return 1; }
+  *r = x + y;
+  return 0;
+#endif
+}
+
+static inline int lnum_sub(long x, long y, long* r) {
+#if defined(__GNUC__)
+  return __builtin_sub_overflow(x, y, r);
+#else
+  if ((y < 0 && x > LONG_MAX + y) || (y > 0 && x < LONG_MIN + y)) { return 1; }
+  *r = x - y;
+  return 0;
+#endif
+}
+
+static inline int lnum_mul(long x, long y, long* r) {
+#if defined(__GNUC__)
+  return __builtin_mul_overflow(x, y, r);
+#else
+  if (x > 0) {
+    if (y > 0 ? x > LONG_MAX / y : y < LONG_MIN / x) { return 1; }
+  } else if (x < 0) {
+    if (y > 0 ? x < LONG_MIN / y : (y < 0 && x < LONG_MAX / y)) { return 1; }
+  }
+  *r = x * y;
+  return 0;
+#endif
+}
+
+/* Reductions of the n numbers in xs into r. Return LNUM_TYPE if any is
+ * not a number. Minimum and maximum need n > 0. */
+int lnum_sum(lval** xs, int n, long* r);
+int lnum_product(lval** xs, int n, long* r);
+int lnum_min(lval** xs, int n, long* r);
+int lnum_max(lval** xs, int n, long* r);
+int lnum_dot(lval** xs, lval** ys, int n, long* r);
+
+/* Elementwise sums and products of xs and ys into new numbers in out,
+ * which is left holding no references unless LNUM_OK is returned */
+int lnum_vadd(lval** xs, lval** ys, lval** out, int n);
+int lnum_vmul(lval** xs, lval** ys, lval** out, int n);
+
+#endif
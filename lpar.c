@@ -0,0 +1,207 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include "lpar.h"
+#include "lgc.h"
+#include "lstats.h"
+#include "lsym.h"
+
+int lpar_threads = 0;
+LTHREAD int lpar_active = 0;
+LTHREAD int lpar_worker = 0;
+
+/* Run chunks in a frame of their own so '=' never writes to e */
+static void lpar_chunk_run(lenv* e, int lo, int hi, lpar_fn fn, void* ctx) {
+  lenv* frame = lenv_new();
+  frame->par = e;
+  fn(frame, lo, hi, ctx);
+  lenv_del(frame);
+}
+
+/* Run every chunk in this thread, as a worker would */
+static void lpar_run_here(lenv* e, int n, lpar_fn fn, void* ctx) {
+  int worker = lpar_worker;
+  lpar_worker = 1;
+  lpar_chunk_run(e, 0, n, fn, ctx);
+  lpar_worker = worker;
+}
+
+#if LPAR
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define LPAR_MAX_THREADS 64
+
+/* Chunks given to each worker, more lets busy workers shed work */
+#define LPAR_CHUNKS 8
+
+/* Workers recurse as deeply as the main thread may */
+#define LPAR_STACK (64L << 20)
+
+typedef struct {
+  int lo;
+  int hi;
+} lpar_chunk;
+
+/* The owner takes chunks from the back, others steal from the front */
+typedef struct {
+  pthread_mutex_t lock;
+  lpar_chunk chunks[LPAR_CHUNKS];
+  int head;
+  int tail;
+} lpar_deque;
+
+typedef struct {
+  pthread_t thread;
+  int id;
+  lpar_deque q;
+  lgc_heap heap;
+  lstats stats;
+} lpar_thread;
+
+static lpar_thread* lpar_pool = NULL;
+static int lpar_nthreads = 0;
+static int lpar_started = 0;
+
+/* Job being run, a new one starts each time 'lpar_job' changes */
+static pthread_mutex_t lpar_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lpar_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t lpar_done = PTHREAD_COND_INITIALIZER;
+static long lpar_job = 0;
+static int lpar_running = 0;
+static lenv* lpar_env;
+static lsym_table* lpar_syms;
+static lpar_fn lpar_func;
+static void* lpar_ctx;
+
+/* Held by the interpreter using the workers, others run work themselves */
+static pthread_mutex_t lpar_owner = PTHREAD_MUTEX_INITIALIZER;
+
+static int lpar_take(lpar_deque* q, lpar_chunk* c, int steal) {
+  pthread_mutex_lock(&q->lock);
+  int ok = q->head < q->tail;
+  if (ok) { *c = steal ? q->chunks[q->head++] : q->chunks[--q->tail]; }
+  pthread_mutex_unlock(&q->lock);
+  return ok;
+}
+
+static int lpar_next(lpar_thread* t, lpar_chunk* c) {
+  if (lpar_take(&t->q, c, 0)) { return 1; }
+  for (int i = 1; i < lpar_nthreads; i++) {
+    if (lpar_take(&lpar_pool[(t->id + i) % lpar_nthreads].q, c, 1)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void* lpar_main(void* arg) {
+  lpar_thread* t = arg;
+  lpar_worker = 1;
+  lpar_active = 1;
+  lgc_cur = &t->heap;
+  lstats_cur = &t->stats;
+
+  long seen = 0;
+  pthread_mutex_lock(&lpar_lock);
+  while (1) {
+    while (lpar_job == seen) { pthread_cond_wait(&lpar_start, &lpar_lock); }
+    seen = lpar_job;
+    lsym_cur = lpar_syms;
+    pthread_mutex_unlock(&lpar_lock);
+
+    lpar_chunk c;
+    while (lpar_next(t, &c)) {
+      lpar_chunk_run(lpar_env, c.lo, c.hi, lpar_func, lpar_ctx);
+    }
+
+    pthread_mutex_lock(&lpar_lock);
+    if (--lpar_running == 0) { pthread_cond_signal(&lpar_done); }
+  }
+  return NULL;
+}
+
+/* Start the workers on first use, returning how many there are. Called
+ * holding 'lpar_owner'. */
+static int lpar_init(void) {
+  if (lpar_started) { return lpar_nthreads; }
+  lpar_started = 1;
+
+  int n = lpar_threads > 0 ? lpar_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1) { n = 1; }
+  if (n > LPAR_MAX_THREADS) { n = LPAR_MAX_THREADS; }
+  if (n == 1) { return 0; }
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, LPAR_STACK);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  lpar_pool = calloc(n, sizeof(lpar_thread));
+  for (int i = 0; i < n; i++) {
+    lpar_thread* t = &lpar_pool[i];
+    t->id = i;
+    pthread_mutex_init(&t->q.lock, NULL);
+    lgc_heap_init(&t->heap);
+    if (pthread_create(&t->thread, &attr, lpar_main, t) != 0) { break; }
+    lpar_nthreads++;
+  }
+  pthread_attr_destroy(&attr);
+  return lpar_nthreads;
+}
+
+void lpar_run(lenv* e, int n, lpar_fn fn, void* ctx) {
+  if (n <= 0) { return; }
+
+  /* Work started by a worker is run by that worker, as is work of an
+   * interpreter which finds the workers busy with another's */
+  if (lpar_worker || n < 2 || pthread_mutex_trylock(&lpar_owner) != 0) {
+    lpar_run_here(e, n, fn, ctx);
+    return;
+  }
+  int nthreads = lpar_init();
+  if (nthreads < 2) {
+    pthread_mutex_unlock(&lpar_owner);
+    lpar_run_here(e, n, fn, ctx);
+    return;
+  }
+
+  /* Give each worker a run of neighbouring chunks */
+  int nchunks = n < nthreads * LPAR_CHUNKS ? n : nthreads * LPAR_CHUNKS;
+  for (int i = 0; i < nthreads; i++) {
+    lpar_pool[i].q.head = 0;
+    lpar_pool[i].q.tail = 0;
+  }
+  for (int i = 0; i < nchunks; i++) {
+    lpar_deque* q = &lpar_pool[(long)i * nthreads / nchunks].q;
+    lpar_chunk c = { (int)((long)i * n / nchunks),
+      (int)((long)(i + 1) * n / nchunks) };
+    q->chunks[q->tail++] = c;
+  }
+
+  pthread_mutex_lock(&lpar_lock);
+  lpar_env = e;
+  lpar_syms = lsym_cur;
+  lpar_func = fn;
+  lpar_ctx = ctx;
+  lpar_running = nthreads;
+  lpar_job++;
+  pthread_cond_broadcast(&lpar_start);
+  while (lpar_running > 0) { pthread_cond_wait(&lpar_done, &lpar_lock); }
+  pthread_mutex_unlock(&lpar_lock);
+
+  /* Values made by workers now belong to this thread */
+  for (int i = 0; i < nthreads; i++) {
+    lgc_heap_merge(lgc_cur, &lpar_pool[i].heap);
+    lstats_merge(lstats_cur, &lpar_pool[i].stats);
+  }
+  pthread_mutex_unlock(&lpar_owner);
+}
+
+#else
+
+void lpar_run(lenv* e, int n, lpar_fn fn, void* ctx) {
+  if (n > 0) { lpar_run_here(e, n, fn, ctx); }
+}
+
+#endif
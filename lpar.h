@@ -0,0 +1,68 @@
+#ifndef LPAR_H
+#define LPAR_H
+
+#include "lval.h"
+#include "lenv.h"
+
+/* Parallel evaluation.
+ *
+ * Work is split into chunks of a range of indices which are spread over
+ * the deques of a pool of worker threads; a worker that runs out takes
+ * chunks from the others. While workers run, reference counts change
+ * atomically, the collector is off and each worker allocates into a
+ * heap of its own which is handed to the calling thread afterwards.
+ * Workers see the global environment read only. Build with -DLPAR=0 to
+ * run the chunks in the calling thread instead. */
+#ifndef LPAR
+#define LPAR 1
+#endif
+
+/* Storage private to each thread */
+#if LPAR && defined(__GNUC__)
+#define LTHREAD __thread
+#else
+#undef LPAR
+#define LPAR 0
+#define LTHREAD
+#endif
+
+/* Number of workers, or zero for one per processor */
+extern int lpar_threads;
+
+/* Set in threads which may share values with others, which are the
+ * workers, and in threads running work as a worker would */
+extern LTHREAD int lpar_active;
+extern LTHREAD int lpar_worker;
+
+/* Reference counts shared with workers */
+static inline void lpar_retain(int* refs) {
+#if LPAR
+  if (lpar_active) { __atomic_fetch_add(refs, 1, __ATOMIC_RELAXED); return; }
+#endif
+  (*refs)++;
+}
+
+/* Drop a reference, returning how many are left */
+static inline int lpar_release(int* refs) {
+#if LPAR
+  if (lpar_active) { return __atomic_sub_fetch(refs, 1, __ATOMIC_ACQ_REL); }
+#endif
+  return --*refs;
+}
+
+/* Whether something counted by refs is held more than once */
+static inline int lpar_shared(int* refs) {
+#if LPAR
+  if (lpar_active) { return __atomic_load_n(refs, __ATOMIC_ACQUIRE) != 1; }
+#endif
+  return *refs != 1;
+}
+
+/* Work on indices lo up to hi */
+typedef void(*lpar_fn)(lenv* e, int lo, int hi, void* ctx);
+
+/* Run fn over chunks covering 0 up to n and wait for all of them. Each
+ * chunk gets a fresh frame whose parent is e. */
+void lpar_run(lenv* e, int n, lpar_fn fn, void* ctx);
+
+#endif
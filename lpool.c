@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lpool.h"
+#include "lpar.h"
+
+#if LPOOL
+
+/* Size classes are multiples of the grain up to the largest pooled size,
+ * anything bigger goes to the system allocator */
+#define LPOOL_GRAIN 16
+#define LPOOL_MAX 512
+#define LPOOL_CLASSES (LPOOL_MAX / LPOOL_GRAIN)
+
+/* Blocks of a class are carved from slabs of this size */
+#define LPOOL_SLAB 65536
+
+typedef struct lpool_block {
+  struct lpool_block* next;
+} lpool_block;
+
+/* Each thread allocates from lists of its own. Blocks freed by another
+ * thread join that thread's lists, slabs are never returned. */
+static LTHREAD lpool_block* lpool_free_lists[LPOOL_CLASSES];
+
+static int lpool_class(size_t size) {
+  return (int)((size - 1) / LPOOL_GRAIN);
+}
+
+static void lpool_refill(int c) {
+  size_t block = (size_t)(c + 1) * LPOOL_GRAIN;
+  char* slab = malloc(LPOOL_SLAB);
+
+  /* Thread the free list through every block of the new slab */
+  lpool_block* head = NULL;
+  for (size_t off = LPOOL_SLAB - LPOOL_SLAB % block; off >= block; off -= block) {
+    lpool_block* b = (lpool_block*)(slab + off - block);
+    b->next = head;
+    head = b;
+  }
+  lpool_free_lists[c] = head;
+}
+
+void* lpool_alloc(size_t size) {
+  if (size == 0) { return NULL; }
+  if (size > LPOOL_MAX) { return malloc(size); }
+
+  int c = lpool_class(size);
+  if (!lpool_free_lists[c]) { lpool_refill(c); }
+
+  lpool_block* b = lpool_free_lists[c];
+  lpool_free_lists[c] = b->next;
+  return b;
+}
+
+void lpool_free(void* p, size_t size) {
+  if (!p) { return; }
+  if (size > LPOOL_MAX) { free(p); return; }
+
+  int c = lpool_class(size);
+  lpool_block* b = p;
+  b->next = lpool_free_lists[c];
+  lpool_free_lists[c] = b;
+}
+
+void* lpool_realloc(void* p, size_t old_size, size_t new_size) {
+  if (!p) { return lpool_alloc(new_size); }
+  if (old_size > LPOOL_MAX && new_size > LPOOL_MAX) {
+    return realloc(p, new_size);
+  }
+
+  /* Nothing to do if both sizes fall in the same class */
+  if (old_size <= LPOOL_MAX && new_size <= LPOOL_MAX && new_size > 0
+    && lpool_class(old_size) == lpool_class(new_size)) {
+    return p;
+  }
+
+  void* n = lpool_alloc(new_size);
+  if (n) { memcpy(n, p, old_size < new_size ? old_size : new_size); }
+  lpool_free(p, old_size);
+  return n;
+}
+
+#else
+
+void* lpool_alloc(size_t size) {
+  return malloc(size);
+}
+
+void* lpool_realloc(void* p, size_t old_size, size_t new_size) {
+  return realloc(p, new_size);
+}
+
+void lpool_free(void* p, size_t size) {
+  free(p);
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef LPOOL_H
+#define LPOOL_H
+
+#include <stddef.h>
+
+/* Size class pool allocator for lval nodes and small cell arrays.
+ * Build with -DLPOOL=0 to use the system allocator instead. */
+#ifndef LPOOL
+#define LPOOL 1
+#endif
+
+void* lpool_alloc(size_t size);
+void* lpool_realloc(void* p, size_t old_size, size_t new_size);
+void lpool_free(void* p, size_t size);
+
+#endif
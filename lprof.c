@@ -0,0 +1,222 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lprof.h"
+
+LTHREAD int lprof_enabled = 0;
+
+/* Profiled function, all those bound to one name */
+typedef struct {
+  char* name;
+  long calls;
+  long incl;
+  long excl;
+
+  /* Calls now on the stack, inclusive time is only counted for the
+   * outermost of recursive calls */
+  int active;
+} lprof_fn;
+
+/* Distinct stack of calls, a child of the stack without its last call */
+typedef struct {
+  int fn;
+  int parent;
+  long excl;
+} lprof_node;
+
+/* Call on the profiled stack */
+typedef struct {
+  int node;
+  long start;
+  long child;
+} lprof_frame;
+
+static lprof_fn* lprof_fns = NULL;
+static int lprof_nfns = 0;
+
+static lprof_node* lprof_nodes = NULL;
+static int lprof_nnodes = 0;
+
+static lprof_frame* lprof_stack = NULL;
+static int lprof_depth = 0;
+static int lprof_cap = 0;
+
+/* Open addressing tables, capacities are powers of two. 'keys' maps
+ * the body of a lambda or the function of a builtin to a function, and
+ * 'paths' maps a parent node and function to a node. */
+typedef struct {
+  uintptr_t* keys;
+  uintptr_t* keys2;
+  int* vals;
+  int count;
+  int cap;
+} lprof_table;
+
+static lprof_table lprof_keys;
+static lprof_table lprof_paths;
+
+static unsigned long lprof_hash(uintptr_t k, uintptr_t k2) {
+  unsigned long h = (unsigned long)(k ^ (k2 * 0x9E3779B1UL));
+  return h ^ (h >> 15);
+}
+
+static void lprof_table_grow(lprof_table* t);
+
+/* Slot holding k and k2, or the empty slot where they belong */
+static int lprof_table_find(lprof_table* t, uintptr_t k, uintptr_t k2) {
+  if ((t->count + 1) * 2 > t->cap) { lprof_table_grow(t); }
+  int i = lprof_hash(k, k2) & (t->cap - 1);
+  while (t->vals[i] >= 0 && (t->keys[i] != k || t->keys2[i] != k2)) {
+    i = (i + 1) & (t->cap - 1);
+  }
+  return i;
+}
+
+static void lprof_table_grow(lprof_table* t) {
+  lprof_table old = *t;
+  t->cap = t->cap ? t->cap * 2 : 256;
+  t->count = 0;
+  t->keys = malloc(sizeof(uintptr_t) * t->cap);
+  t->keys2 = malloc(sizeof(uintptr_t) * t->cap);
+  t->vals = malloc(sizeof(int) * t->cap);
+  for (int i = 0; i < t->cap; i++) { t->vals[i] = -1; }
+  for (int i = 0; i < old.cap; i++) {
+    if (old.vals[i] < 0) { continue; }
+    int j = lprof_table_find(t, old.keys[i], old.keys2[i]);
+    t->keys[j] = old.keys[i];
+    t->keys2[j] = old.keys2[i];
+    t->vals[j] = old.vals[i];
+    t->count++;
+  }
+  free(old.keys);
+  free(old.keys2);
+  free(old.vals);
+}
+
+static void lprof_table_put(lprof_table* t, int i, uintptr_t k,
+  uintptr_t k2, int v) {
+  t->keys[i] = k;
+  t->keys2[i] = k2;
+  t->vals[i] = v;
+  t->count++;
+}
+
+/* Lambdas are identified by their body, which copies and partial
+ * applications share, and builtins by their function */
+static uintptr_t lprof_key(lval* f) {
+  return f->builtin ? (uintptr_t)f->builtin : (uintptr_t)f->body;
+}
+
+static int lprof_fn_named(char* name) {
+  for (int i = 0; i < lprof_nfns; i++) {
+    if (strcmp(lprof_fns[i].name, name) == 0) { return i; }
+  }
+  lprof_fns = realloc(lprof_fns, sizeof(lprof_fn) * (lprof_nfns + 1));
+  lprof_fn* fn = &lprof_fns[lprof_nfns];
+  fn->name = malloc(strlen(name) + 1);
+  strcpy(fn->name, name);
+  fn->calls = fn->incl = fn->excl = 0;
+  fn->active = 0;
+  return lprof_nfns++;
+}
+
+void lprof_name(lval* f, char* name) {
+  int i = lprof_table_find(&lprof_keys, lprof_key(f), 0);
+  if (lprof_keys.vals[i] >= 0) { return; }
+
+  /* Hold the body so its address is not reused by another */
+  if (!f->builtin) { lval_copy(f->body); }
+  lprof_table_put(&lprof_keys, i, lprof_key(f), 0, lprof_fn_named(name));
+}
+
+static long lprof_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void lprof_enter(lval* f) {
+  int i = lprof_table_find(&lprof_keys, lprof_key(f), 0);
+  if (lprof_keys.vals[i] < 0) {
+    lprof_name(f, "<lambda>");
+    i = lprof_table_find(&lprof_keys, lprof_key(f), 0);
+  }
+  int fn = lprof_keys.vals[i];
+
+  int parent = lprof_depth ? lprof_stack[lprof_depth-1].node : -1;
+  int j = lprof_table_find(&lprof_paths, (uintptr_t)fn, (uintptr_t)parent);
+  if (lprof_paths.vals[j] < 0) {
+    lprof_nodes = realloc(lprof_nodes, sizeof(lprof_node) * (lprof_nnodes + 1));
+    lprof_nodes[lprof_nnodes] = (lprof_node){ fn, parent, 0 };
+    lprof_table_put(&lprof_paths, j, (uintptr_t)fn, (uintptr_t)parent,
+      lprof_nnodes++);
+  }
+
+  if (lprof_depth == lprof_cap) {
+    lprof_cap = lprof_cap ? lprof_cap * 2 : 64;
+    lprof_stack = realloc(lprof_stack, sizeof(lprof_frame) * lprof_cap);
+  }
+  lprof_stack[lprof_depth++] = (lprof_frame){ lprof_paths.vals[j], 0, 0 };
+
+  lprof_fns[fn].calls++;
+  lprof_fns[fn].active++;
+
+  /* Start the clock last so the profiler's own work is not counted */
+  lprof_stack[lprof_depth-1].start = lprof_now();
+}
+
+void lprof_exit(void) {
+  long now = lprof_now();
+  lprof_frame* c = &lprof_stack[--lprof_depth];
+  lprof_fn* fn = &lprof_fns[lprof_nodes[c->node].fn];
+
+  long total = now - c->start;
+  long excl = total - c->child;
+  fn->excl += excl;
+  lprof_nodes[c->node].excl += excl;
+  if (--fn->active == 0) { fn->incl += total; }
+  if (lprof_depth) { lprof_stack[lprof_depth-1].child += total; }
+}
+
+static int lprof_cmp(const void* x, const void* y) {
+  long a = lprof_fns[*(int*)x].excl;
+  long b = lprof_fns[*(int*)y].excl;
+  return (a < b) - (a > b);
+}
+
+/* Functions called, by exclusive time */
+void lprof_print(FILE* f) {
+  int* order = malloc(sizeof(int) * (lprof_nfns + 1));
+  int n = 0;
+  for (int i = 0; i < lprof_nfns; i++) {
+    if (lprof_fns[i].calls) { order[n++] = i; }
+  }
+  qsort(order, n, sizeof(int), lprof_cmp);
+
+  fprintf(f, "%-24s %10s %12s %12s\n", "function", "calls",
+    "incl ms", "excl ms");
+  for (int i = 0; i < n; i++) {
+    lprof_fn* fn = &lprof_fns[order[i]];
+    fprintf(f, "%-24s %10li %12.3f %12.3f\n", fn->name, fn->calls,
+      fn->incl / 1e6, fn->excl / 1e6);
+  }
+  free(order);
+}
+
+static void lprof_print_path(FILE* f, int node) {
+  if (lprof_nodes[node].parent >= 0) {
+    lprof_print_path(f, lprof_nodes[node].parent);
+    fputc(';', f);
+  }
+  fputs(lprof_fns[lprof_nodes[node].fn].name, f);
+}
+
+void lprof_print_stacks(FILE* f) {
+  for (int i = 0; i < lprof_nnodes; i++) {
+    long us = lprof_nodes[i].excl / 1000;
+    if (!us) { continue; }
+    lprof_print_path(f, i);
+    fprintf(f, " %li\n", us);
+  }
+}
@@ -0,0 +1,29 @@
+#ifndef LPROF_H
+#define LPROF_H
+
+#include <stdio.h>
+#include "lval.h"
+#include "lpar.h"
+
+/* Function level profiler.
+ *
+ * Calls are counted against the name a function was first bound to by
+ * 'def' or '=', with the time spent in them including and excluding the
+ * functions they call. A tail call replaces its caller on the profiled
+ * stack as it does on the real one. Time spent under each distinct
+ * stack is kept for collapsed stack output, one line per stack of names
+ * separated by ';' and followed by microseconds, as read by flame graph
+ * tools. */
+
+/* Profile calls, set before builtins are added so they are named. Calls
+ * made by parallel workers are not profiled. */
+extern LTHREAD int lprof_enabled;
+
+void lprof_name(lval* f, char* name);
+void lprof_enter(lval* f);
+void lprof_exit(void);
+
+void lprof_print(FILE* f);
+void lprof_print_stacks(FILE* f);
+
+#endif
@@ -0,0 +1,60 @@
+#include <string.h>
+#include "lstats.h"
+
+/* Counters of the interpreter that is running */
+static lstats lstats_main;
+LTHREAD lstats* lstats_cur = &lstats_main;
+
+int lstats_report = 0;
+
+char* lstats_type_name(int type) {
+  static char* names[LVAL_NTYPES] = {
+    [LVAL_NUM] = "num", [LVAL_ERR] = "err", [LVAL_SYM] = "sym",
+    [LVAL_STR] = "str", [LVAL_FUN] = "fun", [LVAL_SEXPR] = "sexpr",
+    [LVAL_QEXPR] = "qexpr", [LVAL_VEC] = "vec", [LVAL_MAP] = "map",
+    [LVAL_MAPNODE] = "mapnode"
+  };
+  return type >= 0 && type < LVAL_NTYPES ? names[type] : "unknown";
+}
+
+/* Add the counts of 'from' to s, leaving it zeroed */
+void lstats_merge(lstats* s, lstats* from) {
+  for (int t = 0; t < LVAL_NTYPES; t++) {
+    s->allocs[t] += from->allocs[t];
+    s->frees[t] += from->frees[t];
+  }
+  s->live += from->live;
+  if (s->live > s->peak) { s->peak = s->live; }
+  s->copies += from->copies;
+  s->copy_bytes += from->copy_bytes;
+  s->env_copies += from->env_copies;
+  s->env_copy_bytes += from->env_copy_bytes;
+  s->evals += from->evals;
+  s->ops += from->ops;
+  s->calls += from->calls;
+  s->lookups += from->lookups;
+  s->probes += from->probes;
+  memset(from, 0, sizeof(lstats));
+}
+
+void lstats_print(lstats* s, FILE* f) {
+  long allocs = 0, frees = 0;
+  for (int t = 0; t < LVAL_NTYPES; t++) {
+    allocs += s->allocs[t];
+    frees += s->frees[t];
+  }
+  fprintf(f, "stats: %li values allocated, %li freed, %li live, peak %li\n",
+    allocs, frees, s->live, s->peak);
+  for (int t = 0; t < LVAL_NTYPES; t++) {
+    if (!s->allocs[t] && !s->frees[t]) { continue; }
+    fprintf(f, "stats:   %-8s %12li allocated %12li freed\n",
+      lstats_type_name(t), s->allocs[t], s->frees[t]);
+  }
+  fprintf(f, "stats: %li values copied (%li bytes), "
+    "%li frames copied (%li bytes)\n",
+    s->copies, s->copy_bytes, s->env_copies, s->env_copy_bytes);
+  fprintf(f, "stats: %li eval steps, %li vm ops, %li calls\n",
+    s->evals, s->ops, s->calls);
+  fprintf(f, "stats: %li lookups, %li frames probed\n",
+    s->lookups, s->probes);
+}
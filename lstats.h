@@ -0,0 +1,74 @@
+#ifndef LSTATS_H
+#define LSTATS_H
+
+#include <stdio.h>
+#include "lval.h"
+#include "lpar.h"
+
+/* Runtime counters.
+ *
+ * Counts values allocated and freed by type, shallow copies made when
+ * a shared value is written, frames copied, evaluation steps, calls and
+ * symbol lookups. Each interpreter counts into its own set, the one
+ * 'lstats_cur' points to. Build with -DLSTATS=0 to leave them out. */
+#ifndef LSTATS
+#define LSTATS 1
+#endif
+
+typedef struct lstats {
+  long allocs[LVAL_NTYPES];
+  long frees[LVAL_NTYPES];
+  long live;
+  long peak;
+
+  /* Values copied by lval_own and frames copied by lenv_copy */
+  long copies;
+  long copy_bytes;
+  long env_copies;
+  long env_copy_bytes;
+
+  /* Expressions evaluated by the tree walker and instructions run by
+   * the bytecode machine */
+  long evals;
+  long ops;
+  long calls;
+
+  /* Symbols looked up and frames searched for them */
+  long lookups;
+  long probes;
+} lstats;
+
+extern LTHREAD lstats* lstats_cur;
+
+/* Print the counters at exit */
+extern int lstats_report;
+
+#if LSTATS
+#define LSTATS_ADD(field, n) (lstats_cur->field += (n))
+
+static inline void lstats_alloc(int type) {
+  lstats_cur->allocs[type]++;
+  if (++lstats_cur->live > lstats_cur->peak) {
+    lstats_cur->peak = lstats_cur->live;
+  }
+}
+
+static inline void lstats_free(int type) {
+  lstats_cur->frees[type]++;
+  lstats_cur->live--;
+}
+#else
+#define LSTATS_ADD(field, n) ((void)0)
+static inline void lstats_alloc(int type) {}
+static inline void lstats_free(int type) {}
+#endif
+
+#define LSTATS_INC(field) LSTATS_ADD(field, 1)
+
+/* Short name of a type as used in reports */
+char* lstats_type_name(int type);
+
+void lstats_merge(lstats* s, lstats* from);
+void lstats_print(lstats* s, FILE* f);
+
+#endif
@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lstr.h"
+#include "lgc.h"
+#include "lpar.h"
+#include "limg.h"
+
+static struct lstr* lstr_new(long cap) {
+  struct lstr* b = malloc(sizeof(struct lstr));
+  b->refs = 1;
+  b->used = 0;
+  b->cap = cap;
+  b->data = malloc(cap + 1);
+  b->data[0] = '\0';
+  return b;
+}
+
+void lstr_retain(struct lstr* b) {
+  lpar_retain(&b->refs);
+}
+
+void lstr_release(struct lstr* b) {
+  if (lpar_release(&b->refs) > 0) { return; }
+  free(b->data);
+  free(b);
+}
+
+/* String viewing characters of buffer b, whose reference it takes */
+static lval* lstr_view(struct lstr* b, long off, long n) {
+  lval* v = lgc_alloc(LVAL_STR);
+  v->sbuf = b;
+  v->soff = off;
+  v->slen = n;
+  return v;
+}
+
+/* String holding a copy of the n characters at s */
+lval* lval_strn(char* s, long n) {
+  struct lstr* b = lstr_new(n);
+  memcpy(b->data, s, n);
+  b->data[n] = '\0';
+  b->used = n;
+  return lstr_view(b, 0, n);
+}
+
+/* Characters of v from 'start' up to 'end', sharing its buffer */
+lval* lval_substr(lval* v, long start, long end) {
+  lstr_retain(v->sbuf);
+  return lstr_view(v->sbuf, v->soff + start, end - start);
+}
+
+/* String v followed by the n characters at s. Consumes v. */
+lval* lval_str_append(lval* v, char* s, long n) {
+  struct lstr* b = v->sbuf;
+
+  /* Characters past the end of v may be viewed by other strings, so
+   * copy v into a new buffer with room to grow. While workers run the
+   * buffer must not be shared at all, as others may be reading it, and
+   * a buffer of an image is never written. */
+  if (v->soff + v->slen != b->used || limg_contains(b)
+    || (lpar_active && (lpar_shared(&b->refs) || lpar_shared(&v->refs)))) {
+    long len = v->slen + n;
+    struct lstr* x = lstr_new(len > 16 ? len * 2 : 32);
+    memcpy(x->data, lval_str_data(v), v->slen);
+    memcpy(x->data + v->slen, s, n);
+    x->data[len] = '\0';
+    x->used = len;
+    lval_del(v);
+    return lstr_view(x, 0, len);
+  }
+
+  if (b->used + n > b->cap) {
+    /* s may point into the buffer being moved */
+    uintptr_t p = (uintptr_t)s;
+    uintptr_t data = (uintptr_t)b->data;
+    long alias = p >= data && p <= data + b->used ? (long)(p - data) : -1;
+
+    b->cap = (b->used + n) * 2;
+    b->data = realloc(b->data, b->cap + 1);
+    if (alias >= 0) { s = b->data + alias; }
+  }
+  memmove(b->data + b->used, s, n);
+  b->used += n;
+  b->data[b->used] = '\0';
+
+  /* Unshared strings grow in place */
+  if (!lpar_shared(&v->refs)) {
+    v->slen += n;
+    return v;
+  }
+  lval* x = lval_substr(v, 0, v->slen + n);
+  lval_del(v);
+  return x;
+}
+
+/* NUL terminated copy of the characters of v */
+char* lval_str_cstr(lval* v) {
+  char* s = malloc(v->slen + 1);
+  memcpy(s, lval_str_data(v), v->slen);
+  s[v->slen] = '\0';
+  return s;
+}
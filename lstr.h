@@ -0,0 +1,33 @@
+#ifndef LSTR_H
+#define LSTR_H
+
+#include "lval.h"
+
+/* Strings are views of 'slen' characters from 'soff' in a buffer which
+ * may be shared with other strings. Taking a substring shares the
+ * buffer. Appending to a string which ends where its buffer ends writes
+ * in place, as no other string views characters past that point, so a
+ * string built up piece by piece is copied only as its buffer grows.
+ *
+ * A buffer is kept NUL terminated at 'used', but a string viewing only
+ * part of it is not terminated. */
+struct lstr {
+  int refs;
+  long used;
+  long cap;
+  char* data;
+};
+
+static inline char* lval_str_data(lval* v) {
+  return v->sbuf->data + v->soff;
+}
+
+lval* lval_strn(char* s, long n);
+lval* lval_substr(lval* v, long start, long end);
+lval* lval_str_append(lval* v, char* s, long n);
+char* lval_str_cstr(lval* v);
+
+void lstr_retain(struct lstr* b);
+void lstr_release(struct lstr* b);
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lsym.h"
+
+#if LPAR
+#include <pthread.h>
+#endif
+
+/* Well known names are the same in every table */
+char* lsym_amp = "&";
+char* lsym_lambda = "\\";
+char* lsym_if = "if";
+
+/* Open addressing table of canonical names, capacity is a power of two */
+struct lsym_table {
+  char** names;
+  unsigned long cap;
+  unsigned long count;
+#if LPAR
+  /* Held by workers while they use the table */
+  pthread_mutex_t lock;
+#endif
+};
+
+static lsym_table lsym_main = {
+#if LPAR
+  .lock = PTHREAD_MUTEX_INITIALIZER
+#endif
+};
+LTHREAD lsym_table* lsym_cur = &lsym_main;
+
+static unsigned long lsym_hash(char* s) {
+  /* FNV-1a */
+  unsigned long h = 2166136261UL;
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+static int lsym_well_known(char* s) {
+  return s == lsym_amp || s == lsym_lambda || s == lsym_if;
+}
+
+static void lsym_grow(lsym_table* t) {
+  unsigned long cap = t->cap ? t->cap * 2 : 256;
+  char** names = calloc(cap, sizeof(char*));
+
+  /* Reinsert existing names into the larger table */
+  for (unsigned long i = 0; i < t->cap; i++) {
+    if (!t->names[i]) { continue; }
+    unsigned long j = lsym_hash(t->names[i]) & (cap - 1);
+    while (names[j]) { j = (j + 1) & (cap - 1); }
+    names[j] = t->names[i];
+  }
+
+  free(t->names);
+  t->names = names;
+  t->cap = cap;
+}
+
+/* Canonical name equal to s. A new name is copied unless 'keep' is set,
+ * when s itself is stored. */
+static char* lsym_insert(lsym_table* t, char* s, int keep) {
+  /* Keep load factor below one half */
+  if ((t->count + 1) * 2 > t->cap) { lsym_grow(t); }
+
+  unsigned long i = lsym_hash(s) & (t->cap - 1);
+  while (t->names[i]) {
+    if (strcmp(t->names[i], s) == 0) { return t->names[i]; }
+    i = (i + 1) & (t->cap - 1);
+  }
+
+  /* Not found so store the name */
+  if (keep) {
+    t->names[i] = s;
+  } else {
+    t->names[i] = malloc(strlen(s) + 1);
+    strcpy(t->names[i], s);
+  }
+  t->count++;
+  return t->names[i];
+}
+
+static char* lsym_lookup(lsym_table* t, char* s) {
+  /* Well known names are interned along with the first lookup */
+  if (!t->cap) {
+    lsym_insert(t, lsym_amp, 1);
+    lsym_insert(t, lsym_lambda, 1);
+    lsym_insert(t, lsym_if, 1);
+  }
+  return lsym_insert(t, s, 0);
+}
+
+lsym_table* lsym_table_new(void) {
+  lsym_table* t = calloc(1, sizeof(lsym_table));
+#if LPAR
+  pthread_mutex_init(&t->lock, NULL);
+#endif
+  return t;
+}
+
+void lsym_table_del(lsym_table* t) {
+  for (unsigned long i = 0; i < t->cap; i++) {
+    if (t->names[i] && !lsym_well_known(t->names[i])) { free(t->names[i]); }
+  }
+  free(t->names);
+#if LPAR
+  pthread_mutex_destroy(&t->lock);
+#endif
+  free(t);
+}
+
+char* lsym_intern(char* s) {
+  lsym_table* t = lsym_cur;
+#if LPAR
+  if (lpar_active) {
+    pthread_mutex_lock(&t->lock);
+    char* x = lsym_lookup(t, s);
+    pthread_mutex_unlock(&t->lock);
+    return x;
+  }
+#endif
+  return lsym_lookup(t, s);
+}
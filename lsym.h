@@ -0,0 +1,27 @@
+#ifndef LSYM_H
+#define LSYM_H
+
+#include "lpar.h"
+
+/* Interned symbol names. Every symbol name passed through lsym_intern
+ * yields one canonical string, so symbols can be compared by pointer.
+ * Each interpreter interns into a table of its own. */
+
+typedef struct lsym_table lsym_table;
+
+/* Table this thread interns into */
+extern LTHREAD lsym_table* lsym_cur;
+
+/* Canonical name of the '&' variadic marker used in formals */
+extern char* lsym_amp;
+
+/* Canonical names of the lambda and if builtins */
+extern char* lsym_lambda;
+extern char* lsym_if;
+
+lsym_table* lsym_table_new(void);
+void lsym_table_del(lsym_table* t);
+
+char* lsym_intern(char* s);
+
+#endif
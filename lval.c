@@ -2,9 +2,19 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
-#include <errno.h>
+#include <limits.h>
 #include "lval.h"
 #include "lenv.h"
+#include "lsym.h"
+#include "lgc.h"
+#include "lpool.h"
+#include "lvm.h"
+#include "lmemo.h"
+#include "lmap.h"
+#include "lstr.h"
+#include "lprof.h"
+#include "lstats.h"
+#include "lpar.h"
 
 char* ltype_name(int t) {
   switch(t) {
@@ -15,22 +25,26 @@ char* ltype_name(int t) {
     case LVAL_FUN: return "Function";
     case LVAL_SEXPR: return "S-Expression";
     case LVAL_QEXPR: return "Q-Expression";
+    case LVAL_VEC: return "Vector";
+    case LVAL_MAP: return "Hash Map";
+    case LVAL_MAPNODE: return "Hash Map Node";
     default: return "Unknown";
   }
 }
 
-/* Construct a pointer to a new Number lval */
+/* Construct a pointer to a new Number lval, unboxed if it fits */
 lval* lval_num(long x) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_NUM;
+  if (x >= LVAL_FIXNUM_MIN && x <= LVAL_FIXNUM_MAX) {
+    return (lval*)(((uintptr_t)x << 1) | 1);
+  }
+  lval* v = lgc_alloc(LVAL_NUM);
   v->num = x;
   return v;
 }
 
 /* Construct a pointer to a new Error lval */
 lval* lval_err(char* fmt, ...) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_ERR;
+  lval* v = lgc_alloc(LVAL_ERR);
 
   /* Create a va list and initialize it */
   va_list va;
@@ -53,52 +67,50 @@ lval* lval_err(char* fmt, ...) {
 
 /* Construct a pointer to a new Symbol lval */
 lval* lval_sym(char* s) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_SYM;
-  v->sym = malloc(strlen(s) + 1);
-  strcpy(v->sym, s);
+  lval* v = lgc_alloc(LVAL_SYM);
+  v->sym = lsym_intern(s);
+  v->depth = -1;
+  v->slot = -1;
   return v;
 }
 
 lval* lval_str(char* s) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_STR;
-  v->str = malloc(strlen(s) + 1);
-  strcpy(v->str, s);
-  return v;
+  return lval_strn(s, strlen(s));
 }
 
 lval* lval_fun(lbuiltin func) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
+  lval* v = lgc_alloc(LVAL_FUN);
   v->builtin = func;
+  v->memo = NULL;
   return v;
 }
 
 /* A pointer to a new empty Sexpr lval */
 lval* lval_sexpr(void) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_SEXPR;
+  lval* v = lgc_alloc(LVAL_SEXPR);
   v->count = 0;
+  v->cap = 0;
   v->cell = NULL;
+  v->base = NULL;
   return v;
 }
 
 /* A pointer to a new empty Qexpr lval */
 lval* lval_qexpr(void) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_QEXPR;
+  lval* v = lgc_alloc(LVAL_QEXPR);
   v->count = 0;
+  v->cap = 0;
   v->cell = NULL;
+  v->base = NULL;
   return v;
 }
 
 lval* lval_lambda(lval* formals, lval* body) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
+  lval* v = lgc_alloc(LVAL_FUN);
 
   /* Set Builtin to Null */
   v->builtin = NULL;
+  v->memo = NULL;
 
   /* Build new environment */
   v->env = lenv_new();
@@ -106,21 +118,145 @@ lval* lval_lambda(lval* formals, lval* body) {
   /* Set Formals and Body */
   v->formals = formals;
   v->body = body;
+
+  /* Compile Body unless using the tree-walking evaluator */
+  v->code = lvm_enabled ? lvm_compile(body) : NULL;
+  return v;
+}
+
+/* Vector viewing cells of the list 'store', whose reference it takes */
+lval* lval_vec(lval* store, int start, int len) {
+  lval* v = lgc_alloc(LVAL_VEC);
+  v->store = store;
+  v->start = start;
+  v->len = len;
+  return v;
+}
+
+lval* lval_map(void) {
+  lval* v = lgc_alloc(LVAL_MAP);
+  v->root = NULL;
+  v->nkeys = 0;
+  return v;
+}
+
+/* Slot a name is bound to in a frame built from these formals, or -1 */
+static int lval_formal_slot(lval* formals, char* sym) {
+  int slot = 0;
+  for (int i = 0; i < formals->count; i++) {
+    if (formals->cell[i]->sym == lsym_amp) { continue; }
+    if (formals->cell[i]->sym == sym) { return slot; }
+    slot++;
+  }
+  return -1;
+}
+
+/* Consumes v and returns it annotated, unsharing only changed nodes */
+static lval* lval_resolve_expr(lval* v, lval** scopes, int nscopes) {
+  switch (lval_type(v)) {
+    case LVAL_SYM:
+      /* Innermost enclosing lambda binding the name wins */
+      for (int d = 0; d < nscopes; d++) {
+        int slot = lval_formal_slot(scopes[nscopes-1-d], v->sym);
+        if (slot < 0) { continue; }
+        if (v->depth != d || v->slot != slot) {
+          v = lval_own(v);
+          v->depth = d;
+          v->slot = slot;
+        }
+        break;
+      }
+      break;
+
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      /* A literal nested lambda opens a new scope for its body */
+      if (v->type == LVAL_SEXPR && v->count == 3
+        && lval_type(v->cell[0]) == LVAL_SYM && v->cell[0]->sym == lsym_lambda
+        && lval_type(v->cell[1]) == LVAL_QEXPR
+        && lval_type(v->cell[2]) == LVAL_QEXPR) {
+        lval* inner[nscopes+1];
+        memcpy(inner, scopes, sizeof(lval*) * nscopes);
+        inner[nscopes] = v->cell[1];
+        lval* x = lval_resolve_expr(lval_copy(v->cell[2]), inner, nscopes+1);
+        if (x != v->cell[2]) {
+          v = lval_own(v);
+          lval_del(v->cell[2]);
+          v->cell[2] = x;
+        } else {
+          lval_del(x);
+        }
+        break;
+      }
+      for (int i = 0; i < v->count; i++) {
+        lval* x = lval_resolve_expr(lval_copy(v->cell[i]), scopes, nscopes);
+        if (x != v->cell[i]) {
+          v = lval_own(v);
+          lval_del(v->cell[i]);
+          v->cell[i] = x;
+        } else {
+          lval_del(x);
+        }
+      }
+      break;
+  }
   return v;
 }
 
+/* Annotate symbols in body with the frame depth and slot they are bound
+ * to. Addresses are hints checked on lookup, as frames are chained at
+ * call time and a body may be evaluated outside of its own frame. */
+lval* lval_resolve(lval* formals, lval* body) {
+  return lval_resolve_expr(body, &formals, 1);
+}
 
 lval* lval_add(lval* v, lval* x) {
-  v->count++;
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-  v->cell[v->count-1] = x;
+  /* Grow capacity geometrically */
+  if (v->count == v->cap) {
+    int cap = v->cap ? v->cap * 2 : 4;
+    v->cell = lpool_realloc(v->cell,
+      sizeof(lval*) * v->cap, sizeof(lval*) * cap);
+    v->cap = cap;
+  }
+  v->cell[v->count++] = x;
   return v;
 }
 
+/* Values are immutable once shared, so copying only adds a reference */
 lval* lval_copy(lval* v) {
+  if (lval_is_fixnum(v)) { return v; }
+  lpar_retain(&v->refs);
+  return v;
+}
 
-  lval* x = malloc(sizeof(lval));
-  x->type = v->type;
+/* Give slice v cells of its own in place of those of its base */
+static void lval_unslice(lval* v) {
+  lval** cell = lpool_alloc(sizeof(lval*) * v->count);
+  LSTATS_ADD(copy_bytes, sizeof(lval*) * v->count);
+  for (int i = 0; i < v->count; i++) {
+    cell[i] = lval_copy(v->cell[i]);
+  }
+  lval_del(v->base);
+  v->cell = cell;
+  v->cap = v->count;
+  v->base = NULL;
+}
+
+/* Return v unshared so it can be modified in place. Consumes the
+ * reference to v; if others still hold v a shallow copy is made whose
+ * children are shared with v. */
+lval* lval_own(lval* v) {
+  if (lval_is_fixnum(v)) { return v; }
+  if (!lpar_shared(&v->refs)) {
+    if ((v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) && v->base) {
+      lval_unslice(v);
+    }
+    return v;
+  }
+
+  lval* x = lgc_alloc(v->type);
+  LSTATS_INC(copies);
+  LSTATS_ADD(copy_bytes, lgc_size(v->type));
 
   switch (v->type) {
 
@@ -133,7 +269,10 @@ lval* lval_copy(lval* v) {
         x->env = lenv_copy(v->env);
         x->formals = lval_copy(v->formals);
         x->body = lval_copy(v->body);
+        x->code = v->code ? lcode_copy(v->code) : NULL;
       }
+      /* A copy of a memoized function starts with an empty cache */
+      x->memo = v->memo ? lmemo_new(v->memo->cap) : NULL;
       break;
     case LVAL_NUM: x->num = v->num; break;
 
@@ -142,62 +281,123 @@ lval* lval_copy(lval* v) {
       x->err = malloc(strlen(v->err) + 1);
       strcpy(x->err, v->err); break;
 
+    /* Symbol names are interned so share the canonical string */
     case LVAL_SYM:
-      x->sym = malloc(strlen(v->sym) + 1);
-      strcpy(x->sym, v->sym); break;
+      x->sym = v->sym;
+      x->depth = v->depth;
+      x->slot = v->slot;
+      break;
 
+    /* Strings share their buffer */
     case LVAL_STR:
-      x->str = malloc(strlen(v->str) + 1);
-      strcpy(x->str, v->str); break;
+      lstr_retain(v->sbuf);
+      x->sbuf = v->sbuf;
+      x->soff = v->soff;
+      x->slen = v->slen;
+      break;
 
-    /* Copy Lists by copying each sub-expression */
+    /* Copy Lists by sharing each sub-expression */
     case LVAL_SEXPR:
     case LVAL_QEXPR:
       x->count = v->count;
-      x->cell = malloc(sizeof(lval*) * x->count);
+      x->cap = v->count;
+      x->base = NULL;
+      x->cell = lpool_alloc(sizeof(lval*) * x->cap);
+      LSTATS_ADD(copy_bytes, sizeof(lval*) * x->cap);
       for (int i = 0; i < x->count; i++) {
         x->cell[i] = lval_copy(v->cell[i]);
       }
       break;
+
+    /* Vectors share the cells they view */
+    case LVAL_VEC:
+      x->store = lval_copy(v->store);
+      x->start = v->start;
+      x->len = v->len;
+      break;
+
+    /* Maps share their trie, copying nodes as they are changed */
+    case LVAL_MAP:
+      x->root = v->root ? lval_copy(v->root) : NULL;
+      x->nkeys = v->nkeys;
+      break;
+    case LVAL_MAPNODE:
+      x->bitmap = v->bitmap;
+      x->nslots = v->nslots;
+      x->slots = lpool_alloc(sizeof(lval*) * 2 * x->nslots);
+      LSTATS_ADD(copy_bytes, sizeof(lval*) * 2 * x->nslots);
+      for (int i = 0; i < 2 * x->nslots; i++) {
+        x->slots[i] = v->slots[i] ? lval_copy(v->slots[i]) : NULL;
+      }
+      break;
   }
 
+  /* Dropped only now as another holder may have let go meanwhile */
+  lval_del(v);
   return x;
 }
 
 void lval_del(lval* v) {
 
+  /* Only free once the last reference is dropped */
+  if (lval_is_fixnum(v) || lpar_release(&v->refs) > 0) { return; }
+
   switch (v->type) {
     /* Do nothing special for number type */
     case LVAL_NUM: break;
 
     /* For Err or Sym free the string data */
     case LVAL_ERR: free(v->err); break;
-    case LVAL_SYM: free(v->sym); break;
-    case LVAL_STR: free(v->str); break;
+    /* Symbol names are interned and never freed */
+    case LVAL_SYM: break;
+    case LVAL_STR: lstr_release(v->sbuf); break;
     case LVAL_FUN:
     if (!v->builtin) {
       lenv_del(v->env);
       lval_del(v->formals);
       lval_del(v->body);
+      if (v->code) { lcode_del(v->code); }
     }
+    if (v->memo) { lmemo_del(v->memo); }
     break;
 
     /* If Sexpr or Qexpr then delete all elements inside */
     case LVAL_SEXPR:
     case LVAL_QEXPR:
+      /* A slice only holds its base */
+      if (v->base) { lval_del(v->base); break; }
       for (int i = 0; i < v->count; i++) {
         lval_del(v->cell[i]);
       }
       /* Also free the memory allocated to contain the pointers */
-      free(v->cell);
+      lpool_free(v->cell, sizeof(lval*) * v->cap);
     break;
+
+    case LVAL_VEC: lval_del(v->store); break;
+    case LVAL_MAP: if (v->root) { lval_del(v->root); } break;
+    case LVAL_MAPNODE:
+      for (int i = 0; i < 2 * v->nslots; i++) {
+        if (v->slots[i]) { lval_del(v->slots[i]); }
+      }
+      if (v->slots) { lpool_free(v->slots, sizeof(lval*) * 2 * v->nslots); }
+      break;
   }
 
   /* Free the memory allocated for the "lval" struct itself */
-  free(v);
+  lgc_free(v);
 }
 
 
+/* Make room for at least 'cap' cells in list v */
+lval* lval_reserve(lval* v, int cap) {
+  if (cap > v->cap) {
+    v->cell = lpool_realloc(v->cell,
+      sizeof(lval*) * v->cap, sizeof(lval*) * cap);
+    v->cap = cap;
+  }
+  return v;
+}
+
 lval* lval_pop(lval* v, int i) {
   /* Find the item at "i" */
   lval* x = v->cell[i];
@@ -206,46 +406,75 @@ lval* lval_pop(lval* v, int i) {
   memmove(&v->cell[i], &v->cell[i+1],
     sizeof(lval*) * (v->count-i-1));
 
-  /* Decrease the count of items in the list */
+  /* Decrease the count of items in the list, keeping the capacity */
   v->count--;
-
-  /* Reallocate the memory used */
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
   return x;
 }
 
 lval* lval_take(lval* v, int i) {
+  /* Share the item if 'v' is still referenced elsewhere or a slice */
+  if (lpar_shared(&v->refs) || v->base) {
+    lval* x = lval_copy(v->cell[i]);
+    lval_del(v);
+    return x;
+  }
   lval* x = lval_pop(v, i);
   lval_del(v);
   return x;
 }
 
+/* Q-Expression of the cells of list v from 'start' up to 'end', sharing
+ * the cells of v rather than copying them */
+lval* lval_slice(lval* v, int start, int end) {
+  lval* x = lval_qexpr();
+  if (start == end) { return x; }
+  x->base = lval_copy(v->base ? v->base : v);
+  x->cell = v->cell + start;
+  x->count = end - start;
+  return x;
+}
+
 lval* lval_join(lval* x, lval* y) {
 
   /* For each cell in 'y' add it to 'x' */
-  while (y->count) {
-    x = lval_add(x, lval_pop(y, 0));
+  x = lval_own(x);
+  for (int i = 0; i < y->count; i++) {
+    x = lval_add(x, lval_copy(y->cell[i]));
   }
 
-  /* Delete the empty 'y' and return 'x' */
+  /* Delete 'y' and return 'x' */
   lval_del(y);
   return x;
 }
 
+/* Whether each key visited is bound to an equal value in 'other' */
+typedef struct {
+  lval* other;
+  int eq;
+} lval_map_eq;
+
+static void lval_map_eq_visit(lval* k, lval* v, void* ctx) {
+  lval_map_eq* c = ctx;
+  if (!c->eq) { return; }
+  lval* x = lmap_get(c->other, k);
+  c->eq = x && lval_eq(v, x);
+}
+
 int lval_eq(lval* x, lval* y) {
 
   /* Different Types are always unequal */
-  if (x->type != y->type) { return 0; }
+  if (lval_type(x) != lval_type(y)) { return 0; }
 
   /* Compare Based upon type */
-  switch (x->type) {
+  switch (lval_type(x)) {
     /* Compare Number Value */
-    case LVAL_NUM: return (x->num == y->num);
+    case LVAL_NUM: return (lval_as_num(x) == lval_as_num(y));
 
-    /* Compare String Values */
+    /* Compare String Values, Symbols are interned */
     case LVAL_ERR: return (strcmp(x->err, y->err) == 0);
-    case LVAL_SYM: return (strcmp(x->sym, y->sym) == 0);
-    case LVAL_STR: return (strcmp(x->str, y->str) == 0);
+    case LVAL_SYM: return (x->sym == y->sym);
+    case LVAL_STR: return x->slen == y->slen
+      && memcmp(lval_str_data(x), lval_str_data(y), x->slen) == 0;
 
     /* If builtin compare, otherwise compare formals and body */
     case LVAL_FUN:
@@ -267,184 +496,484 @@ int lval_eq(lval* x, lval* y) {
       /* Otherwise lists must be equal */
       return 1;
     break;
+
+    case LVAL_VEC:
+      if (x->len != y->len) { return 0; }
+      for (int i = 0; i < x->len; i++) {
+        if (!lval_eq(lval_vec_cells(x)[i], lval_vec_cells(y)[i])) { return 0; }
+      }
+      return 1;
+
+    /* Maps are equal if each key of one is bound to an equal value in the
+     * other, whatever order they were added in */
+    case LVAL_MAP: {
+      if (x->nkeys != y->nkeys) { return 0; }
+      lval_map_eq ctx = { y, 1 };
+      lmap_each(x, lval_map_eq_visit, &ctx);
+      return ctx.eq;
+    }
   }
   return 0;
 }
 
+/* Mix x into hash h */
+static unsigned long lval_hash_mix(unsigned long h, unsigned long x) {
+  return (h ^ x) * 16777619UL;
+}
+
+static unsigned long lval_hash_str(char* s, long n) {
+  unsigned long h = 2166136261UL;
+  for (long i = 0; i < n; i++) { h = lval_hash_mix(h, (unsigned char)s[i]); }
+  return h;
+}
+
+static void lval_map_hash_visit(lval* k, lval* v, void* ctx) {
+  *(unsigned long*)ctx += lval_hash_mix(lval_hash(k), lval_hash(v));
+}
+
+/* Structural hash, equal for values lval_eq finds equal */
+unsigned long lval_hash(lval* v) {
+  unsigned long h = lval_hash_mix(2166136261UL, lval_type(v));
+  switch (lval_type(v)) {
+    case LVAL_NUM: return lval_hash_mix(h, (unsigned long)lval_as_num(v));
+    case LVAL_ERR: return lval_hash_mix(h, lval_hash_str(v->err, strlen(v->err)));
+    case LVAL_SYM: return lval_hash_mix(h, (unsigned long)(uintptr_t)v->sym);
+    case LVAL_STR:
+      return lval_hash_mix(h, lval_hash_str(lval_str_data(v), v->slen));
+    case LVAL_FUN:
+      if (v->builtin) {
+        return lval_hash_mix(h, (unsigned long)(uintptr_t)v->builtin);
+      }
+      return lval_hash_mix(lval_hash_mix(h, lval_hash(v->formals)),
+        lval_hash(v->body));
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      for (int i = 0; i < v->count; i++) {
+        h = lval_hash_mix(h, lval_hash(v->cell[i]));
+      }
+      return h;
+    case LVAL_VEC:
+      for (int i = 0; i < v->len; i++) {
+        h = lval_hash_mix(h, lval_hash(lval_vec_cells(v)[i]));
+      }
+      return h;
+    case LVAL_MAP: {
+      /* Summed so that order does not matter */
+      unsigned long sum = 0;
+      lmap_each(v, lval_map_hash_visit, &sum);
+      return lval_hash_mix(h, sum);
+    }
+  }
+  return h;
+}
+
 
-lval* builtin_eval(lenv* e, lval* a);
 lval* builtin_list(lenv* e, lval* a);
+lval* builtin_if(lenv* e, lval* a);
+lval* builtin_eval(lenv* e, lval* a);
+lval* builtin_if_expr(lval* a);
+lval* builtin_eval_expr(lval* a);
 
-lval* lval_call(lenv* e, lval* f, lval* a) {
+/* Partial application of lambda 'f' with the arguments bound in 'env'
+ * and formals from 'i' onwards still to be given */
+static lval* lval_partial(lval* f, lenv* env, int i) {
+  lval* v = lgc_alloc(LVAL_FUN);
+  v->builtin = NULL;
+  v->memo = NULL;
+  v->env = env;
+  v->formals = lval_qexpr();
+  for (; i < f->formals->count; i++) {
+    lval_add(v->formals, lval_copy(f->formals->cell[i]));
+  }
+  v->body = lval_copy(f->body);
+  v->code = f->code ? lcode_copy(f->code) : NULL;
+  return v;
+}
 
-  /* If Builtin then simply apply that */
-  if (f->builtin) { return f->builtin(e, a); }
+/* Bind arguments 'a' to the formals of lambda 'f' in a new frame, which
+ * the lambda itself is not changed by. Returns NULL and sets 'frame'
+ * once every formal is bound and the body is ready to run, otherwise
+ * the result of the call, an error or the partially applied function. */
+static lval* lval_bind(lenv* e, lval* f, lval* a, lenv** frame) {
 
   /* Record Argument Counts */
   int given = a->count;
   int total = f->formals->count;
+  lval** formals = f->formals->cell;
+
+  /* Start from any arguments bound by partial application */
+  lenv* env = f->env->count ? lenv_copy(f->env) : lenv_new();
+  env->par = NULL;
+
+  int i = 0;
+  int j = 0;
 
   /* While arguments still remain to be processed */
-  while (a->count) {
+  for (; j < a->count; j++) {
 
     /* If we've ran out of formal arguments to bind */
-    if (f->formals->count == 0) {
-      lval_del(a); return lval_err(
+    if (i == total) {
+      lenv_del(env); lval_del(a); return lval_err(
         "Function passed too many arguments. "
         "Got %i, Expected %i.", given, total);
     }
 
-    /* Pop the first symbol from the formals */
-    lval* sym = lval_pop(f->formals, 0);
+    lval* sym = formals[i++];
 
-	/* Special Case to deal with '&' */
-    if (strcmp(sym->sym, "&") == 0) {
+    /* Special Case to deal with '&' */
+    if (sym->sym == lsym_amp) {
 
       /* Ensure '&' is followed by another symbol */
-      if (f->formals->count != 1) {
-        lval_del(a);
+      if (i != total-1) {
+        lenv_del(env); lval_del(a);
         return lval_err("Function format invalid. "
           "Symbol '&' not followed by single symbol.");
       }
 
       /* Next formal should be bound to remaining arguments */
-      lval* nsym = lval_pop(f->formals, 0);
-      lenv_put(f->env, nsym, builtin_list(e, a));
-      lval_del(sym); lval_del(nsym);
+      lenv_bind(env, formals[i++], lval_slice(a, j, a->count));
       break;
     }
 
-    /* Pop the next argument from the list */
-    lval* val = lval_pop(a, 0);
-
-    /* Bind a copy into the function's environment */
-    lenv_put(f->env, sym, val);
-
-    /* Delete symbol and value */
-    lval_del(sym); lval_del(val);
+    /* Bind the next argument to the next slot */
+    lenv_bind(env, sym, lval_copy(a->cell[j]));
   }
 
   /* Argument list is now bound so can be cleaned up */
   lval_del(a);
 
   /* If '&' remains in formal list bind to empty list */
-  if (f->formals->count > 0 &&
-    strcmp(f->formals->cell[0]->sym, "&") == 0) {
+  if (i < total && formals[i]->sym == lsym_amp) {
 
     /* Check to ensure that & is not passed invalidly. */
-    if (f->formals->count != 2) {
+    if (i != total-2) {
+      lenv_del(env);
       return lval_err("Function format invalid. "
         "Symbol '&' not followed by single symbol.");
     }
 
-    /* Pop and delete '&' symbol */
-    lval_del(lval_pop(f->formals, 0));
-
-    /* Pop next symbol and create empty list */
-    lval* sym = lval_pop(f->formals, 0);
-    lval* val = lval_qexpr();
-
-    /* Bind to environment and delete */
-    lenv_put(f->env, sym, val);
-    lval_del(sym); lval_del(val);
+    /* Bind next symbol to an empty list */
+    lenv_bind(env, formals[i+1], lval_qexpr());
+    i = total;
   }
 
-  /* If all formals have been bound evaluate */
-  if (f->formals->count == 0) {
+  /* If all formals have been bound the body can run */
+  if (i == total) { *frame = env; return NULL; }
 
-    /* Set environment parent to evaluation environment */
-    f->env->par = e;
+  /* Otherwise return partially evaluated function */
+  return lval_partial(f, env, i);
+}
 
-    /* Evaluate and return */
-    return builtin_eval(
-      f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-  } else {
-    /* Otherwise return partially evaluated function */
-    return lval_copy(f);
-  }
+/* Memoized call whose result is still to be remembered */
+typedef struct {
+  lval* f;
+  lval* args;
+  unsigned long hash;
+} lval_memo_call;
+
+/* Evaluate 'v' in 'e', or apply it if 'applied' is set, in which case it
+ * is an S-Expression whose cells are already evaluated. If 'first' is
+ * given it is applied to the arguments 'v' instead. Expressions in
+ * tail position, the body of a lambda, the branches of 'if' and the
+ * argument of 'eval', are evaluated by this loop rather than a nested
+ * call, so tail recursion runs in constant stack. */
+static lval* lval_eval_loop(lenv* e, lval* v, lval* first, int applied) {
+
+  /* Frame of the lambda being run, which is 'e', and frames that are
+   * still parents of it. They are held until the loop returns. */
+  lenv* cur = NULL;
+  lenv** held = NULL;
+  int nheld = 0;
+
+  /* Whether a call made by this loop is on the profiled stack */
+  int profiled = 0;
+
+  /* Memoized calls this loop is running, whose results are remembered
+   * once it returns */
+  lval_memo_call* pending = NULL;
+  int npending = 0;
+
+  lval* result;
+  lval* f = first;
+
+  /* Cleared while running a call missing from its memo table */
+  int cached = 1;
+
+  while (1) {
+    LSTATS_INC(evals);
+
+    /* Evaluate the expression and find the function it applies */
+    if (!f) {
+
+      if (!applied) {
+        if (lval_type(v) == LVAL_SYM) {
+          result = lenv_get(e, v);
+          lval_del(v);
+          break;
+        }
+        if (lval_type(v) != LVAL_SEXPR) { result = v; break; }
+
+        lgc_poll();
+
+        /* Children are evaluated in place */
+        v = lval_own(v);
+
+        for (int i = 0; i < v->count; i++) {
+          /* Detach the child while its reference is owned by lval_eval */
+          lval* x = v->cell[i];
+          v->cell[i] = NULL;
+          v->cell[i] = lval_eval(e, x);
+        }
+      }
+      applied = 0;
 
-}
+      int err = -1;
+      for (int i = 0; i < v->count; i++) {
+        if (lval_type(v->cell[i]) == LVAL_ERR) { err = i; break; }
+      }
+      if (err >= 0) { result = lval_take(v, err); break; }
 
+      if (v->count == 0) { result = v; break; }
+      if (v->count == 1) { result = lval_take(v, 0); break; }
 
-lval* lval_eval_sexpr(lenv* e, lval* v);
+      /* Ensure first element is a function after evaluation */
+      f = lval_pop(v, 0);
+      if (lval_type(f) != LVAL_FUN) {
+        lval_del(v); lval_del(f);
+        result = lval_err("first element is not a function");
+        break;
+      }
+    }
 
-lval* lval_eval(lenv* e, lval* v) {
-  if (v->type == LVAL_SYM) {
-    lval* x = lenv_get(e, v);
-    lval_del(v);
-    return x;
-  }
-  if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
-  return v;
-}
+    /* Continue with the expression 'if' or 'eval' picks */
+    if (f->builtin == builtin_if || f->builtin == builtin_eval) {
+      lval* x = f->builtin == builtin_if
+        ? builtin_if_expr(v) : builtin_eval_expr(v);
+      lval_del(f);
+      f = NULL;
+      if (lval_type(x) == LVAL_ERR) { result = x; break; }
+      v = x;
+      continue;
+    }
 
-lval* lval_eval_sexpr(lenv* e, lval* v) {
+    /* Memoized functions answer from their table, or else run without it
+     * in this loop. Everything the loop runs from here on is in tail
+     * position, so the call's result is that of the loop, and a chain of
+     * memoized tail calls runs in constant stack. Workers leave the table
+     * alone. */
+    if (f->memo && cached && !lpar_worker) {
+      unsigned long hash;
+      lval* x = lmemo_get(f->memo, v, &hash);
+      if (x) {
+        lval_del(v);
+        lval_del(f);
+        result = x;
+        break;
+      }
+      pending = realloc(pending, sizeof(lval_memo_call) * (npending+1));
+      pending[npending].f = lval_copy(f);
+      pending[npending].args = lval_copy(v);
+      pending[npending].hash = hash;
+      npending++;
+      cached = 0;
+      continue;
+    }
+    cached = 1;
+
+    /* If Builtin then simply apply that */
+    LSTATS_INC(calls);
+    if (f->builtin) {
+      if (lprof_enabled) { lprof_enter(f); }
+      result = f->builtin(e, v);
+      if (lprof_enabled) { lprof_exit(); }
+      lval_del(f);
+      break;
+    }
 
-  for (int i = 0; i < v->count; i++) {
-    v->cell[i] = lval_eval(e, v->cell[i]);
-  }
+    /* Lambdas bind arguments into a new frame */
+    lenv* frame = NULL;
+    lval* r = lval_bind(e, f, v, &frame);
+    if (r) { lval_del(f); result = r; break; }
+
+    /* The new frame replaces the current one if it binds every name the
+     * current one does, as nothing in the current one is visible then.
+     * Otherwise it is chained to the current one. */
+    if (cur && lenv_shadows(frame, cur)) {
+      frame->par = cur->par;
+      lenv_del(cur);
+    } else {
+      frame->par = e;
+      if (cur) {
+        held = realloc(held, sizeof(lenv*) * (nheld+1));
+        held[nheld++] = cur;
+      }
+    }
+    cur = frame;
+    e = frame;
+
+    /* A tail call replaces the caller on the profiled stack */
+    if (lprof_enabled) {
+      if (profiled) { lprof_exit(); }
+      lprof_enter(f);
+      profiled = 1;
+    }
 
-  for (int i = 0; i < v->count; i++) {
-    if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    /* Run compiled body, which may end in a call to continue with */
+    if (f->code) {
+      lval* tail = NULL;
+      result = lvm_run(e, f->code, &tail);
+      lval_del(f);
+      f = NULL;
+      if (!tail) { break; }
+      v = tail;
+      applied = 1;
+      continue;
+    }
+
+    /* Otherwise evaluate the body */
+    v = lval_own(lval_copy(f->body));
+    v->type = LVAL_SEXPR;
+    lval_del(f);
+    f = NULL;
   }
 
-  if (v->count == 0) { return v; }
-  if (v->count == 1) { return lval_take(v, 0); }
+  if (profiled) { lprof_exit(); }
+  if (cur) { lenv_del(cur); }
+  for (int i = nheld-1; i >= 0; i--) { lenv_del(held[i]); }
+  free(held);
 
-  /* Ensure first element is a function after evaluation */
-  lval* f = lval_pop(v, 0);
-  if (f->type != LVAL_FUN) {
-    lval_del(v); lval_del(f);
-    return lval_err("first element is not a function");
+  /* Errors are not remembered */
+  for (int i = npending-1; i >= 0; i--) {
+    if (lval_type(result) != LVAL_ERR) {
+      lmemo_put(pending[i].f->memo, pending[i].args, pending[i].hash,
+        lval_copy(result));
+    } else {
+      lval_del(pending[i].args);
+    }
+    lval_del(pending[i].f);
   }
+  free(pending);
 
-  /* If so call function to get result */
-  lval* result = lval_call(e, f, v);
-  lval_del(f);
   return result;
 }
 
+lval* lval_eval(lenv* e, lval* v) {
+  return lval_eval_loop(e, v, NULL, 0);
+}
+
+/* Apply an S-Expression whose cells are already evaluated */
+lval* lval_apply(lenv* e, lval* v) {
+  return lval_eval_loop(e, v, NULL, 1);
+}
+
+/* Apply function 'f' to the evaluated arguments 'a', none an error */
+lval* lval_call(lenv* e, lval* f, lval* a) {
+  return lval_eval_loop(e, a, f, 0);
+}
 
-int lval_read_sym(lval* v, char* s, int i) {
 
-  /* Allocate Empty String */
-  char* part = calloc(1,1);
+/* Character classes used by the reader */
+enum { LREAD_SYM = 1, LREAD_DIGIT = 2, LREAD_SPACE = 4 };
+
+/* Classes of each character, constant so readers may run in any thread */
+#define S LREAD_SYM
+#define D LREAD_DIGIT
+#define W LREAD_SPACE
+static const unsigned char lval_read_class[256] = {
+  ['a'] = S, ['b'] = S, ['c'] = S, ['d'] = S, ['e'] = S, ['f'] = S,
+  ['g'] = S, ['h'] = S, ['i'] = S, ['j'] = S, ['k'] = S, ['l'] = S,
+  ['m'] = S, ['n'] = S, ['o'] = S, ['p'] = S, ['q'] = S, ['r'] = S,
+  ['s'] = S, ['t'] = S, ['u'] = S, ['v'] = S, ['w'] = S, ['x'] = S,
+  ['y'] = S, ['z'] = S, ['A'] = S, ['B'] = S, ['C'] = S, ['D'] = S,
+  ['E'] = S, ['F'] = S, ['G'] = S, ['H'] = S, ['I'] = S, ['J'] = S,
+  ['K'] = S, ['L'] = S, ['M'] = S, ['N'] = S, ['O'] = S, ['P'] = S,
+  ['Q'] = S, ['R'] = S, ['S'] = S, ['T'] = S, ['U'] = S, ['V'] = S,
+  ['W'] = S, ['X'] = S, ['Y'] = S, ['Z'] = S, ['0'] = S|D, ['1'] = S|D,
+  ['2'] = S|D, ['3'] = S|D, ['4'] = S|D, ['5'] = S|D, ['6'] = S|D,
+  ['7'] = S|D, ['8'] = S|D, ['9'] = S|D, ['_'] = S, ['+'] = S, ['-'] = S,
+  ['*'] = S, ['\\'] = S, ['/'] = S, ['='] = S, ['<'] = S, ['>'] = S,
+  ['!'] = S, ['&'] = S, [' '] = W, ['\t'] = W, ['\v'] = W, ['\r'] = W,
+  ['\n'] = W
+};
+#undef S
+#undef D
+#undef W
+
+#define lval_read_is(c, cls) (lval_read_class[(unsigned char)(c)] & (cls))
+
+/* Token buffer shared by the reads of a thread, grown geometrically */
+static LTHREAD char* lval_read_buf = NULL;
+static LTHREAD long lval_read_cap = 0;
+
+static char* lval_read_reserve(long n) {
+  if (n > lval_read_cap) {
+    while (lval_read_cap < n) {
+      lval_read_cap = lval_read_cap ? lval_read_cap * 2 : 64;
+    }
+    lval_read_buf = realloc(lval_read_buf, lval_read_cap);
+  }
+  return lval_read_buf;
+}
 
-  /* While valid identifier characters */
-  while (strchr(
-      "abcdefghijklmnopqrstuvwxyz"
-      "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-      "0123456789_+-*\\/=<>!&", s[i]) && s[i] != '\0') {
+/* Free the token buffer of this thread */
+void lval_read_trim(void) {
+  free(lval_read_buf);
+  lval_read_buf = NULL;
+  lval_read_cap = 0;
+}
 
-    /* Append character to end of string */
-    part = realloc(part, strlen(part)+2);
-    part[strlen(part)+1] = '\0';
-    part[strlen(part)+0] = s[i];
-    i++;
+/* Number from the decimal digits in s[i..j), with an optional leading
+ * '-', or an error if it does not fit in a long */
+static lval* lval_read_num(char* s, long i, long j) {
+  int neg = s[i] == '-';
+  long x = 0;
+  for (long k = i + neg; k < j; k++) {
+    int d = s[k] - '0';
+    /* Accumulate negatively so LONG_MIN can be read */
+    if (x < (LONG_MIN + d) / 10) {
+      long len = j - i;
+      char* part = memcpy(lval_read_reserve(len + 1), s + i, len);
+      part[len] = '\0';
+      return lval_err("Invalid Number %s", part);
+    }
+    x = x * 10 - d;
+  }
+  if (neg) { return lval_num(x); }
+  if (x == LONG_MIN) {
+    long len = j - i;
+    char* part = memcpy(lval_read_reserve(len + 1), s + i, len);
+    part[len] = '\0';
+    return lval_err("Invalid Number %s", part);
   }
+  return lval_num(-x);
+}
+
+long lval_read_sym(lval* v, char* s, long i, long n) {
+
+  /* Find the end of the identifier */
+  long j = i;
+  while (j < n && lval_read_is(s[j], LREAD_SYM)) { j++; }
 
   /* Check if Identifier looks like number */
-  int is_num = strchr("-0123456789", part[0]) ? 1 : 0;
+  int is_num = s[i] == '-' || lval_read_is(s[i], LREAD_DIGIT);
   /* It's not a number if we only have a single '-'. */
-  if (part[0] == '-' && strlen(part) == 1) is_num = 0;
-  for (int i = 1; i < strlen(part); i++) {
-    if (!strchr("0123456789", part[i])) { is_num = 0; break; }
+  if (s[i] == '-' && j - i == 1) { is_num = 0; }
+  for (long k = i+1; is_num && k < j; k++) {
+    if (!lval_read_is(s[k], LREAD_DIGIT)) { is_num = 0; }
   }
 
   /* Add Symbol or Number as lval */
   if (is_num) {
-    errno = 0;
-    long x = strtol(part, NULL, 10);
-    lval_add(v, errno != ERANGE ? lval_num(x) : lval_err("Invalid Number %s", part));
+    lval_add(v, lval_read_num(s, i, j));
   } else {
+    long len = j - i;
+    char* part = memcpy(lval_read_reserve(len + 1), s + i, len);
+    part[len] = '\0';
     lval_add(v, lval_sym(part));
   }
 
-  /* Free temp string */
-  free(part);
-
   /* Return updated position in input */
-  return i;
+  return j;
 }
 
 /* Possible unescapable characters */
@@ -488,163 +1017,205 @@ char* lval_str_escape(char x) {
 }
 
 
-int lval_read_str(lval* v, char* s, int i) {
+long lval_read_str(lval* v, char* s, long i, long n) {
 
-  /* Allocate empty string */
-  char* part = calloc(1,1);
+  /* Unescaped string is no longer than the literal */
+  long len = 0;
 
-  while (s[i] != '"') {
+  for (long j = i; j < n && s[j] != '"'; j++) {
+    if (s[j] == '\\') { j++; }
+    len = j - i + 1;
+  }
+  char* part = lval_read_reserve(len + 1);
+  len = 0;
 
-    char c = s[i];
+  while (i < n && s[i] != '"') {
 
-    /* If end of input then there is an unterminated string literal */
-    if (c == '\0') {
-      lval_add(v, lval_err("Unexpected end of input at string literal"));
-      free(part);
-      return strlen(s);
-    }
+    char c = s[i];
 
     /* If backslash then unescape character after it */
     if (c == '\\') {
       i++;
       /* Check next character is escapable */
-      if (strchr(lval_str_unescapable, s[i])) {
+      if (i < n && s[i] && strchr(lval_str_unescapable, s[i])) {
         c = lval_str_unescape(s[i]);
       } else {
         lval_add(v, lval_err("Invalid escape character %c", c));
-        free(part);
-        return strlen(s);
+        return n+1;
       }
     }
 
     /* Append character to string */
-    part = realloc(part, strlen(part)+2);
-    part[strlen(part)+1] = '\0';
-    part[strlen(part)+0] = c;
+    part[len++] = c;
     i++;
   }
 
-  /* Add lval and free temp string */
-  lval_add(v, lval_str(part));
+  /* If end of input then there is an unterminated string literal */
+  if (i >= n) {
+    lval_add(v, lval_err("Unexpected end of input at string literal"));
+    return n+1;
+  }
 
-  free(part);
+  /* Add lval for the string */
+  lval_add(v, lval_strn(part, len));
 
   return i+1;
 }
 
-int lval_read_expr(lval* v, char* s, int i, char end) {
+/* Skip whitespace and comments */
+long lval_read_space(char* s, long i, long n) {
+  while (i < n) {
+    if (lval_read_is(s[i], LREAD_SPACE)) { i++; continue; }
+    if (s[i] != ';') { break; }
+    /* A comment runs to the end of the line */
+    while (i < n && s[i] != '\n') { i++; }
+  }
+  return i;
+}
 
-  while (s[i] != end) {
+/* Read the expression starting at s[i], after lval_read_space, and add
+ * it to v. Returns the position after it, or n+1 after adding an error. */
+long lval_read_form(lval* v, char* s, long i, long n) {
 
-    /* If we reach end of input then there is some syntax error */
-    if (s[i] == '\0') {
-      lval_add(v, lval_err("Missing %c at end of input", end));
-      return strlen(s)+1;
-    }
+  char c = s[i];
 
-    /* Skip all whitespace */
-    if (strchr(" \t\v\r\n", s[i])) {
-      i++;
-      continue;
-    }
+  /* If next character is ( then read S-Expr */
+  if (c == '(') {
+    lval* x = lval_sexpr();
+    lval_add(v, x);
+    return lval_read_expr(x, s, i+1, n, ')');
+  }
 
-    /* If next char is ; then read comment */
-    if (s[i] == ';') {
-      while (s[i] != '\n' && s[i] != '\0') { i++; }
-      i++;
-      continue;
-    }
+  /* If next character is { then read Q-Expr */
+  if (c == '{') {
+    lval* x = lval_qexpr();
+    lval_add(v, x);
+    return lval_read_expr(x, s, i+1, n, '}');
+  }
 
-    /* If next character is ( then read S-Expr */
-    if (s[i] == '(') {
-      lval* x = lval_sexpr();
-      lval_add(v, x);
-      i = lval_read_expr(x, s, i+1, ')');
-      continue;
-    }
+  /* If next character is [ then read the cells of a Vector */
+  if (c == '[') {
+    lval* x = lval_qexpr();
+    i = lval_read_expr(x, s, i+1, n, ']');
+    lval_add(v, lval_vec(x, 0, x->count));
+    return i;
+  }
 
-    /* If next character is { then read Q-Expr */
-    if (s[i] == '{') {
-      lval* x = lval_qexpr();
-      lval_add(v, x);
-      i = lval_read_expr(x, s, i+1, '}');
-      continue;
-    }
+  /* If next character is part of a symbol then read symbol */
+  if (lval_read_is(c, LREAD_SYM)) {
+    return lval_read_sym(v, s, i, n);
+  }
 
-    /* If next character is part of a symbol then read symbol */
-    if (strchr(
-      "abcdefghijklmnopqrstuvwxyz"
-      "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-      "0123456789_+-*\\/=<>!&", s[i])) {
-      i = lval_read_sym(v, s, i);
-      continue;
-    }
+  /* If next character is " then read string */
+  if (c == '"') {
+    return lval_read_str(v, s, i+1, n);
+  }
 
-     /* If next character is " then read string */
-    if (strchr("\"", s[i])) {
-      i = lval_read_str(v, s, i+1);
-      continue;
+  /* Encountered some unknown character */
+  lval_add(v, lval_err("Unknown Character %c", c));
+  return n+1;
+}
+
+long lval_read_expr(lval* v, char* s, long i, long n, char end) {
+
+  while (1) {
+    i = lval_read_space(s, i, n);
+
+    /* Input may end only at the top level */
+    if (i >= n) {
+      if (end != '\0') {
+        lval_add(v, lval_err("Missing %c at end of input", end));
+      }
+      return n+1;
     }
 
-     /* Encountered some unknown character */
-    lval_add(v, lval_err("Unknown Character %c", s[i]));
-    return strlen(s)+1;
-  }
+    if (s[i] == end) { return i+1; }
 
-  return i+1;
+    i = lval_read_form(v, s, i, n);
+  }
 }
 
 
-void lval_expr_print(lval* v, char open, char close) {
-  putchar(open);
+void lval_expr_print(FILE* f, lval* v, char open, char close) {
+  fputc(open, f);
   for (int i = 0; i < v->count; i++) {
 
     /* Print Value contained within */
-    lval_print(v->cell[i]);
+    lval_fprint(f, v->cell[i]);
 
     /* Don't print trailing space if last element */
     if (i != (v->count-1)) {
-      putchar(' ');
+      fputc(' ', f);
     }
   }
-  putchar(close);
+  fputc(close, f);
 }
 
-void lval_print_str(lval* v) {
-  putchar('"');
+void lval_print_str(FILE* f, lval* v) {
+  fputc('"', f);
   /* Loop over the characters in the string */
-  for (int i = 0; i < strlen(v->str); i++) {
-    if (strchr(lval_str_escapable, v->str[i])) {
+  char* s = lval_str_data(v);
+  for (long i = 0; i < v->slen; i++) {
+    if (s[i] && strchr(lval_str_escapable, s[i])) {
       /* If the character is escapable then escape it */
-      printf("%s", lval_str_escape(v->str[i]));
+      fputs(lval_str_escape(s[i]), f);
     } else {
       /* Otherwise print character as it is */
-      putchar(v->str[i]);
+      fputc(s[i], f);
     }
   }
-  putchar('"');
+  fputc('"', f);
+}
+
+typedef struct {
+  FILE* f;
+  int first;
+} lval_map_printer;
+
+static void lval_map_print_visit(lval* k, lval* v, void* ctx) {
+  lval_map_printer* p = ctx;
+  if (!p->first) { fputc(' ', p->f); }
+  p->first = 0;
+  lval_fprint(p->f, k); fputc(' ', p->f); lval_fprint(p->f, v);
 }
 
 /* Print an "lval" */
-void lval_print(lval* v) {
-  switch (v->type) {
-    case LVAL_NUM:   printf("%li", v->num); break;
-    case LVAL_ERR:   printf("Error: %s", v->err); break;
-    case LVAL_SYM:   printf("%s", v->sym); break;
-    case LVAL_STR:   lval_print_str(v); break;
+void lval_fprint(FILE* f, lval* v) {
+  switch (lval_type(v)) {
+    case LVAL_NUM:   fprintf(f, "%li", lval_as_num(v)); break;
+    case LVAL_ERR:   fprintf(f, "Error: %s", v->err); break;
+    case LVAL_SYM:   fputs(v->sym, f); break;
+    case LVAL_STR:   lval_print_str(f, v); break;
     case LVAL_FUN:
       if (v->builtin) {
-        printf("<builtin>");
+        fputs("<builtin>", f);
       } else {
-        printf("<\\ "); lval_print(v->formals);
-        putchar(' '); lval_print(v->body); putchar('>');
+        fputs("<\\ ", f); lval_fprint(f, v->formals);
+        fputc(' ', f); lval_fprint(f, v->body); fputc('>', f);
+      }
+      break;
+    case LVAL_SEXPR: lval_expr_print(f, v, '(', ')'); break;
+    case LVAL_QEXPR: lval_expr_print(f, v, '{', '}'); break;
+    case LVAL_VEC:
+      fputc('[', f);
+      for (int i = 0; i < v->len; i++) {
+        if (i) { fputc(' ', f); }
+        lval_fprint(f, lval_vec_cells(v)[i]);
       }
+      fputc(']', f);
       break;
-    case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
-    case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
+    case LVAL_MAP: {
+      lval_map_printer p = { f, 1 };
+      fputs("#{", f);
+      lmap_each(v, lval_map_print_visit, &p);
+      fputc('}', f);
+      break;
+    }
   }
 }
 
+void lval_print(lval* v) { lval_fprint(stdout, v); }
+
 /* Print an "lval" followed by a newline */
 void lval_println(lval* v) { lval_print(v); putchar('\n'); }
 
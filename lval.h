@@ -1,8 +1,14 @@
 #ifndef LVAL_H
 #define LVAL_H
 
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+
 /* Create Enumeration of Possible lval Types */
-enum {LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
+enum {LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR,
+  LVAL_VEC, LVAL_MAP, LVAL_MAPNODE, LVAL_NTYPES };
 
 
 #define LASSERT(args, cond, fmt, ...) \
@@ -13,9 +19,9 @@ enum {LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR }
   }
 
 #define LASSERT_TYPE(func, args, index, expect) \
-  LASSERT(args, args->cell[index]->type == expect, \
+  LASSERT(args, lval_type(args->cell[index]) == expect, \
     "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
-    func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+    func, index, ltype_name(lval_type(args->cell[index])), ltype_name(expect))
 
 #define LASSERT_NUM(func, args, num) \
   LASSERT(args, args->count == num, \
@@ -33,24 +39,107 @@ typedef struct lval lval;
 struct lenv;
 typedef lval*(*lbuiltin)(struct lenv*, lval*);
 
+struct lmemo;
+struct lstr;
+
 /* Declare New lval Struct */
 struct lval {
   int type;
-
-  long num;
-  char* err;
-  char* sym;
-  char* str;
-  lbuiltin builtin;
-  struct lenv* env;
-  lval* formals;
-  lval* body;
-
-  /* Count and Pointer to a list of "lval*" */
-  int count;
-  lval** cell;
+  int refs;
+
+  /* Fields used by each type */
+  union {
+    /* Number outside the fixnum range */
+    long num;
+
+    char* err;
+
+    /* String, a view of a buffer described in lstr.h */
+    struct {
+      struct lstr* sbuf;
+      long soff;
+      long slen;
+    };
+
+    /* Symbol, with its lexical address inside a lambda body or
+     * depth -1 if none */
+    struct {
+      char* sym;
+      int depth;
+      int slot;
+    };
+
+    /* Function, a builtin or a lambda with its compiled body, and the
+     * table of its results if memoized */
+    struct {
+      lbuiltin builtin;
+      struct lenv* env;
+      lval* formals;
+      lval* body;
+      struct lcode* code;
+      struct lmemo* memo;
+    };
+
+    /* Count, Capacity and Pointer to a list of "lval*". A slice
+     * views cells owned by the list 'base' and may not be changed in
+     * place until lval_own gives it cells of its own. */
+    struct {
+      int count;
+      int cap;
+      lval** cell;
+      lval* base;
+    };
+
+    /* Vector, a view of 'len' cells from 'start' of a list which may
+     * be shared with other vectors */
+    struct {
+      lval* store;
+      int start;
+      int len;
+    };
+
+    /* Hash map, the root node of its trie and its number of keys */
+    struct {
+      lval* root;
+      int nkeys;
+    };
+
+    /* Node of a hash map trie, see lmap.h */
+    struct {
+      uint32_t bitmap;
+      int nslots;
+      lval** slots;
+    };
+  };
+
+  /* Links in the managed heap and collector scratch count. Only
+   * allocated for lists, vectors and functions. */
+  lval* gc_prev;
+  lval* gc_next;
+  int gc_refs;
 };
 
+/* Size of values which are not tracked by the collector */
+#define LVAL_LEAF_SIZE offsetof(lval, gc_prev)
+
+/* Numbers which fit in all but one bit of a pointer are stored in the
+ * pointer itself, shifted left with the low bit set. There is no struct
+ * behind such a pointer. */
+#define LVAL_FIXNUM_MIN (LONG_MIN >> 1)
+#define LVAL_FIXNUM_MAX (LONG_MAX >> 1)
+
+static inline int lval_is_fixnum(lval* v) {
+  return (uintptr_t)v & 1;
+}
+
+static inline int lval_type(lval* v) {
+  return lval_is_fixnum(v) ? LVAL_NUM : v->type;
+}
+
+static inline long lval_as_num(lval* v) {
+  return lval_is_fixnum(v) ? (long)((intptr_t)v >> 1) : v->num;
+}
+
 char* ltype_name(int t);
 
 lval* lval_num(long x);
@@ -61,19 +150,38 @@ lval* lval_fun(lbuiltin func);
 lval* lval_sexpr(void);
 lval* lval_qexpr(void);
 lval* lval_lambda(lval* formals, lval* body);
+lval* lval_vec(lval* store, int start, int len);
+lval* lval_map(void);
+lval* lval_resolve(lval* formals, lval* body);
 
 lval* lval_add(lval* v, lval* x);
+lval* lval_reserve(lval* v, int cap);
 lval* lval_copy(lval* v);
+lval* lval_own(lval* v);
 void lval_del(lval* v);
 
 lval* lval_pop(lval* v, int i);
 lval* lval_take(lval* v, int i);
+lval* lval_slice(lval* v, int start, int end);
 lval* lval_join(lval* x, lval* y);
 int lval_eq(lval* x, lval* y);
+unsigned long lval_hash(lval* v);
 
-lval* lval_eval(struct lenv* e, lval* v);
+/* First cell of a vector */
+static inline lval** lval_vec_cells(lval* v) {
+  return v->store->cell + v->start;
+}
 
-int lval_read_expr(lval* v, char* s, int i, char end);
+lval* lval_eval(struct lenv* e, lval* v);
+lval* lval_apply(struct lenv* e, lval* v);
+lval* lval_call(struct lenv* e, lval* f, lval* a);
+
+/* Readers take the input s[0..n) and a position in it */
+long lval_read_space(char* s, long i, long n);
+long lval_read_form(lval* v, char* s, long i, long n);
+long lval_read_expr(lval* v, char* s, long i, long n, char end);
+void lval_read_trim(void);
+void lval_fprint(FILE* f, lval* v);
 void lval_print(lval* v);
 void lval_println(lval* v);
 
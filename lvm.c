@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include "lvm.h"
+#include "lsym.h"
+#include "lgc.h"
+#include "builtin.h"
+#include "lstats.h"
+#include "lpar.h"
+
+int lvm_enabled = 1;
+
+/* Instructions and their operands */
+enum {
+  OP_CONST,   /* k: push constant k */
+  OP_LOAD,    /* k: push value of symbol constant k */
+  OP_APPLY,   /* n: apply the S-Expression made of the top n values */
+  OP_IF,      /* t f else end: branch on (if cond {t} {f}) */
+  OP_JUMP,    /* pc: continue at pc */
+  OP_TAIL,    /* n: return the S-Expression made of the top n values
+                 for the caller to apply in place of this call */
+  OP_RETURN   /* return the top value */
+};
+
+struct lcode {
+  int refs;
+
+  int* ops;
+  int count;
+  int cap;
+
+  lval** consts;
+  int nconsts;
+  int cconsts;
+
+  /* Stack depth while compiling and the most ever needed */
+  int depth;
+  int max_depth;
+};
+
+static int lvm_emit(lcode* c, int x) {
+  if (c->count == c->cap) {
+    c->cap = c->cap ? c->cap * 2 : 16;
+    c->ops = realloc(c->ops, sizeof(int) * c->cap);
+  }
+  c->ops[c->count] = x;
+  return c->count++;
+}
+
+static int lvm_const(lcode* c, lval* v) {
+  if (c->nconsts == c->cconsts) {
+    c->cconsts = c->cconsts ? c->cconsts * 2 : 8;
+    c->consts = realloc(c->consts, sizeof(lval*) * c->cconsts);
+  }
+  c->consts[c->nconsts] = lval_copy(v);
+  return c->nconsts++;
+}
+
+static void lvm_push(lcode* c, int n) {
+  c->depth += n;
+  if (c->depth > c->max_depth) { c->max_depth = c->depth; }
+}
+
+static void lvm_compile_sexpr(lcode* c, lval* v, int tail);
+
+/* Code leaving the value of v on the stack */
+static void lvm_compile_expr(lcode* c, lval* v) {
+  switch (lval_type(v)) {
+    case LVAL_SYM:
+      lvm_emit(c, OP_LOAD);
+      lvm_emit(c, lvm_const(c, v));
+      lvm_push(c, 1);
+      break;
+    case LVAL_SEXPR:
+      lvm_compile_sexpr(c, v, 0);
+      break;
+    default:
+      lvm_emit(c, OP_CONST);
+      lvm_emit(c, lvm_const(c, v));
+      lvm_push(c, 1);
+      break;
+  }
+}
+
+/* (if cond {t} {f}) with literal branches */
+static int lvm_is_if(lval* v) {
+  return v->count == 4
+    && lval_type(v->cell[0]) == LVAL_SYM && v->cell[0]->sym == lsym_if
+    && lval_type(v->cell[2]) == LVAL_QEXPR
+    && lval_type(v->cell[3]) == LVAL_QEXPR;
+}
+
+/* Code leaving the result of evaluating the cells of v as an
+ * S-Expression on the stack. In tail position calls are instead
+ * returned to the caller. */
+static void lvm_compile_sexpr(lcode* c, lval* v, int tail) {
+
+  if (lvm_is_if(v)) {
+    lvm_compile_expr(c, v->cell[0]);
+    lvm_compile_expr(c, v->cell[1]);
+
+    /* Room for the branches if 'if' has to be applied normally */
+    lvm_push(c, 2);
+    c->depth -= 4;
+
+    int at = lvm_emit(c, OP_IF);
+    lvm_emit(c, lvm_const(c, v->cell[2]));
+    lvm_emit(c, lvm_const(c, v->cell[3]));
+    lvm_emit(c, 0);
+    lvm_emit(c, 0);
+
+    lvm_compile_sexpr(c, v->cell[2], tail);
+    lvm_emit(c, OP_JUMP);
+    int jump = lvm_emit(c, 0);
+    c->depth--;
+
+    c->ops[at+3] = c->count;
+    lvm_compile_sexpr(c, v->cell[3], tail);
+
+    c->ops[at+4] = c->count;
+    c->ops[jump] = c->count;
+    return;
+  }
+
+  for (int i = 0; i < v->count; i++) {
+    lvm_compile_expr(c, v->cell[i]);
+  }
+
+  /* An empty S-Expression evaluates to itself */
+  if (v->count == 0) { lvm_push(c, 1); }
+
+  lvm_emit(c, tail && v->count > 1 ? OP_TAIL : OP_APPLY);
+  lvm_emit(c, v->count);
+  c->depth -= v->count ? v->count - 1 : 0;
+}
+
+lcode* lvm_compile(lval* body) {
+  lcode* c = calloc(1, sizeof(lcode));
+  c->refs = 1;
+
+  /* The body is evaluated as an S-Expression */
+  lvm_compile_sexpr(c, body, 1);
+  lvm_emit(c, OP_RETURN);
+  return c;
+}
+
+lcode* lcode_copy(lcode* c) {
+  lpar_retain(&c->refs);
+  return c;
+}
+
+void lcode_del(lcode* c) {
+  if (lpar_release(&c->refs) > 0) { return; }
+  for (int i = 0; i < c->nconsts; i++) {
+    lval_del(c->consts[i]);
+  }
+  free(c->consts);
+  free(c->ops);
+  free(c);
+}
+
+/* Apply the top n values of the stack as an evaluated S-Expression */
+static lval* lvm_apply(lenv* e, lval** args, int n) {
+  lval* v = lval_sexpr();
+  for (int i = 0; i < n; i++) { lval_add(v, args[i]); }
+  return lval_apply(e, v);
+}
+
+#if defined(__GNUC__)
+#define LVM_COMPUTED_GOTO
+#endif
+
+lval* lvm_run(lenv* e, lcode* c, lval** tail) {
+  lval* stack[c->max_depth];
+  lval** sp = stack;
+  int* ops = c->ops;
+  int* pc = ops;
+
+#ifdef LVM_COMPUTED_GOTO
+  static void* labels[] = {
+    [OP_CONST] = &&op_CONST, [OP_LOAD] = &&op_LOAD,
+    [OP_APPLY] = &&op_APPLY, [OP_IF] = &&op_IF,
+    [OP_JUMP] = &&op_JUMP, [OP_TAIL] = &&op_TAIL,
+    [OP_RETURN] = &&op_RETURN
+  };
+  #define DISPATCH() goto *(LSTATS_INC(ops), labels[*pc])
+  #define CASE(op) op_##op
+#else
+  #define DISPATCH() continue
+  #define CASE(op) case OP_##op
+  for (;;) switch (LSTATS_INC(ops), *pc) {
+#endif
+
+  DISPATCH();
+
+  CASE(CONST):
+    *sp++ = lval_copy(c->consts[pc[1]]);
+    pc += 2;
+    DISPATCH();
+
+  CASE(LOAD):
+    *sp++ = lenv_get(e, c->consts[pc[1]]);
+    pc += 2;
+    DISPATCH();
+
+  CASE(APPLY): {
+    lgc_poll();
+    int n = pc[1];
+    sp -= n;
+    *sp = lvm_apply(e, sp, n);
+    sp++;
+    pc += 2;
+    DISPATCH();
+  }
+
+  CASE(IF): {
+    lval* f = sp[-2];
+    lval* cond = sp[-1];
+
+    /* Branch directly while 'if' is still the builtin */
+    if (lval_type(f) == LVAL_FUN && f->builtin == builtin_if
+      && lval_type(cond) == LVAL_NUM) {
+      long t = lval_as_num(cond);
+      lval_del(f);
+      lval_del(cond);
+      sp -= 2;
+      pc = t ? pc + 5 : ops + pc[3];
+      DISPATCH();
+    }
+
+    /* Otherwise evaluate the form as written */
+    sp[0] = lval_copy(c->consts[pc[1]]);
+    sp[1] = lval_copy(c->consts[pc[2]]);
+    sp -= 2;
+    *sp = lvm_apply(e, sp, 4);
+    sp++;
+    pc = ops + pc[4];
+    DISPATCH();
+  }
+
+  CASE(JUMP):
+    pc = ops + pc[1];
+    DISPATCH();
+
+  CASE(TAIL): {
+    int n = pc[1];
+    sp -= n;
+    lval* v = lval_sexpr();
+    for (int i = 0; i < n; i++) { lval_add(v, sp[i]); }
+    *tail = v;
+    return NULL;
+  }
+
+  CASE(RETURN):
+    return *--sp;
+
+#ifndef LVM_COMPUTED_GOTO
+  }
+  return NULL;
+#endif
+  #undef DISPATCH
+  #undef CASE
+}
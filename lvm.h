@@ -0,0 +1,29 @@
+#ifndef LVM_H
+#define LVM_H
+
+#include "lval.h"
+#include "lenv.h"
+
+/* Bytecode for lambda bodies.
+ *
+ * A lambda body is compiled once when the lambda is created and is run
+ * on a stack machine each time the lambda is called, instead of copying
+ * and walking the body. Code evaluated with 'eval', top level forms and
+ * lambdas created while the VM is disabled use the tree-walking
+ * evaluator in lval_eval. */
+
+struct lcode;
+typedef struct lcode lcode;
+
+/* Compile lambda bodies, cleared by the --tree option */
+extern int lvm_enabled;
+
+lcode* lvm_compile(lval* body);
+lcode* lcode_copy(lcode* c);
+void lcode_del(lcode* c);
+
+/* Run code in 'e'. A call in tail position is not made but returned
+ * through 'tail' as an evaluated S-Expression, and NULL is returned. */
+lval* lvm_run(lenv* e, lcode* c, lval** tail);
+
+#endif